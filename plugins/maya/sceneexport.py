@@ -35,6 +35,7 @@ def exportVSSD(path, camName, wantTris=False, renderdata=None):
 
     geomList = pmc.ls(type='mesh', visible=True)
     mainFileGeoms = []
+    mainFileInstances = []
     offset = 0
     with open(bufPath, 'wb') as bufFd:
         for geom in geomList:
@@ -44,6 +45,11 @@ def exportVSSD(path, camName, wantTris=False, renderdata=None):
             isSmooth = smoothLevel > 1
             print('Smooth level {}'.format(smoothLevel))
 
+            # Instanced shapes are exported once in object space and placed
+            # by one instance per DAG path
+            isInstanced = geom.isInstanced()
+            space = 'object' if isInstanced else 'world'
+
             faceBuf = ''
             idxBuf = ''
             vtxBuf = ''
@@ -61,7 +67,7 @@ def exportVSSD(path, camName, wantTris=False, renderdata=None):
                 for vtxidx in vtxidxs:
                     idxBuf += struct.pack('<I', vtxidx)
             for vertex in geom.vtx:
-                p = vertex.getPosition('world')
+                p = vertex.getPosition(space)
                 vtxBuf += struct.pack('<fff', p.x, p.y, p.z)
             
             hasCreases = False
@@ -121,9 +127,21 @@ def exportVSSD(path, camName, wantTris=False, renderdata=None):
                     'emittance' : list(emittance)
                 }
             }
+            if isInstanced:
+                prototype = len(mainFileGeoms)
+                geomDict['prototype'] = prototype
+                for path in pmc.ls(geom, allPaths=True):
+                    m = path.getParent().getMatrix(worldSpace=True)
+                    print('Instance {}'.format(path))
+                    mainFileInstances.append({
+                        'prototype' : prototype,
+                        'transform' : [x for row in m for x in row]
+                    })
             mainFileGeoms.append(geomDict)
     
     mainFileDict['geometries'] = mainFileGeoms
+    if mainFileInstances:
+        mainFileDict['instances'] = mainFileInstances
     mainFileJson = json.dumps(mainFileDict, indent=2)
     with open(mainFilePath, 'w') as fd: fd.write(mainFileJson)
     print('Done')
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "aov.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+bool parse_aov(const std::string& name, AovType& type)
+{
+	if(name == "albedo")			type = AovType::albedo;
+	else if(name == "normal")		type = AovType::normal;
+	else if(name == "position")		type = AovType::position;
+	else if(name == "depth")		type = AovType::depth;
+	else if(name == "geomid")		type = AovType::geomid;
+	else if(name == "primid")		type = AovType::primid;
+	else if(name == "direct")		type = AovType::direct;
+	else if(name == "indirect")		type = AovType::indirect;
+	else if(name == "samples")		type = AovType::samples;
+	else return false;
+	return true;
+}
+
+std::vector<std::string> aov_channels(const AovType type)
+{
+	switch(type)
+	{
+		case AovType::albedo:	return {"albedo.R", "albedo.G", "albedo.B"};
+		case AovType::normal:	return {"N.X", "N.Y", "N.Z"};
+		case AovType::position:	return {"P.X", "P.Y", "P.Z"};
+		case AovType::depth:	return {"Z"};
+		case AovType::geomid:	return {"id.geom"};
+		case AovType::primid:	return {"id.prim"};
+		case AovType::direct:	return {"direct.R", "direct.G", "direct.B"};
+		case AovType::indirect:	return {"indirect.R", "indirect.G", "indirect.B"};
+		case AovType::samples:	return {"samples"};
+	}
+	return {};
+}
+
+unsigned aov_size(const AovType type)
+{
+	switch(type)
+	{
+		case AovType::albedo:
+		case AovType::normal:
+		case AovType::position:
+		case AovType::direct:
+		case AovType::indirect:
+			return 3;
+		default:
+			return 1;
+	}
+}
+
+bool aov_id(const AovType type)
+{
+	return type == AovType::geomid || type == AovType::primid;
+}
+
+// Floats summed per pixel, the sample count is always kept
+unsigned aov_storage(const AovType type)
+{
+	return type == AovType::samples || aov_id(type) ? 0 : aov_size(type);
+}
+
+// Id of the pixels nothing was hit in, as RTC_INVALID_GEOMETRY_ID
+static const uint32_t no_id = ~0u;
+
+// Sums over the samples that hit something rather than over all samples
+bool aov_per_hit(const AovType type)
+{
+	return
+		type != AovType::direct &&
+		type != AovType::indirect &&
+		type != AovType::samples;
+}
+
+AovBuffer::AovBuffer()
+	: width(0)
+	, height(0)
+	, pixel_floats(0)
+	, pixel_ids(0)
+{}
+
+void AovBuffer::configure
+(
+	const std::vector<AovType>& a,
+	const unsigned w,
+	const unsigned h
+) {
+	aovs = a;
+	width = w;
+	height = h;
+	offsets.clear();
+	pixel_floats = 2;
+	pixel_ids = 0;
+	for(const AovType type : aovs)
+	{
+		if(aov_id(type))
+		{
+			offsets.push_back(pixel_ids++);
+			continue;
+		}
+		offsets.push_back(pixel_floats);
+		pixel_floats += aov_storage(type);
+	}
+	sums.assign(aovs.empty() ? 0 : size_t(width)*height*pixel_floats, 0);
+	ids.assign(size_t(width)*height*pixel_ids, no_id);
+}
+
+void AovBuffer::clear()
+{
+	std::fill(sums.begin(), sums.end(), 0.0f);
+	std::fill(ids.begin(), ids.end(), no_id);
+}
+
+bool AovBuffer::empty() const
+{
+	return aovs.empty();
+}
+
+unsigned AovBuffer::nchannels() const
+{
+	unsigned n = 0;
+	for(const AovType type : aovs) n += aov_size(type);
+	return n;
+}
+
+std::vector<std::string> AovBuffer::channel_names() const
+{
+	std::vector<std::string> names;
+	for(const AovType type : aovs)
+	{
+		for(const std::string& name : aov_channels(type)) names.push_back(name);
+	}
+	return names;
+}
+
+std::vector<bool> AovBuffer::id_channels() const
+{
+	std::vector<bool> id;
+	for(const AovType type : aovs)
+	{
+		id.insert(id.end(), aov_size(type), aov_id(type));
+	}
+	return id;
+}
+
+void AovBuffer::add(const size_t pixel, const AovSample& s, const Vec3f& li)
+{
+	float* p = &sums[pixel*pixel_floats];
+	uint32_t* id = ids.data() + pixel*pixel_ids;
+	p[1] += 1;
+	if(s.hit) p[0] += 1;
+
+	auto add3 = [](float* c, const Vec3f& v)
+	{
+		c[0] += v[0];
+		c[1] += v[1];
+		c[2] += v[2];
+	};
+	for(size_t k = 0; k < aovs.size(); ++k)
+	{
+		float* c = p + offsets[k];
+		if(aov_per_hit(aovs[k]) && !s.hit) continue;
+		switch(aovs[k])
+		{
+			case AovType::albedo:	add3(c, s.albedo); break;
+			case AovType::normal:	add3(c, s.normal); break;
+			case AovType::position:	add3(c, s.position); break;
+			case AovType::depth:	c[0] += s.depth; break;
+			// Ids can not be averaged, the first hit of the pixel is kept
+			case AovType::geomid:	if(p[0] == 1) id[offsets[k]] = s.geomid; break;
+			case AovType::primid:	if(p[0] == 1) id[offsets[k]] = s.primid; break;
+			case AovType::direct:	add3(c, s.direct); break;
+			case AovType::indirect:	add3(c, li - s.direct); break;
+			case AovType::samples:	break;
+		}
+	}
+}
+
+float* AovBuffer::resolve_pixel
+(
+	const size_t k,
+	const size_t pixel,
+	float* out
+) const {
+	const float* p = &sums[pixel*pixel_floats];
+	const float hits = p[0];
+	const float samples = p[1];
+	const AovType type = aovs[k];
+	if(type == AovType::samples)
+	{
+		*out++ = samples;
+		return out;
+	}
+	if(aov_id(type))
+	{
+		std::memcpy(out++, &ids[pixel*pixel_ids + offsets[k]], sizeof(float));
+		return out;
+	}
+	const float* c = p + offsets[k];
+	const float w = aov_per_hit(type) ? hits : samples;
+	for(unsigned i = 0; i < aov_size(type); ++i) *out++ = w > 0 ? c[i] / w : 0;
+	return out;
+}
+
+void AovBuffer::resolve
+(
+	const OIIO::ROI& roi,
+	float* out,
+	const size_t stride,
+	const size_t row_stride
+) const {
+	for(int y = roi.ybegin; y < roi.yend; ++y)
+	for(int x = roi.xbegin; x < roi.xend; ++x)
+	{
+		const size_t pixel = size_t(y)*width + x;
+		float* o = out + (y - roi.ybegin)*row_stride + (x - roi.xbegin)*stride;
+		for(size_t k = 0; k < aovs.size(); ++k) o = resolve_pixel(k, pixel, o);
+	}
+}
+
+bool AovBuffer::resolve
+(
+	const AovType type,
+	const OIIO::ROI& roi,
+	float* out
+) const {
+	const size_t k = std::find(aovs.begin(), aovs.end(), type) - aovs.begin();
+	if(k == aovs.size()) return false;
+	for(int y = roi.ybegin; y < roi.yend; ++y)
+	for(int x = roi.xbegin; x < roi.xend; ++x)
+	{
+		out = resolve_pixel(k, size_t(y)*width + x, out);
+	}
+	return true;
+}
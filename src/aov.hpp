@@ -0,0 +1,108 @@
+#ifndef _AOV_HPP_
+#define _AOV_HPP_
+
+#include "math.hpp"
+
+#include <OpenImageIO/imagebuf.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Arbitrary output variables, written next to the beauty channels
+enum class AovType
+{
+	// Diffuse albedo at the camera hit
+	albedo,
+	// Shading normal at the camera hit, facing the camera
+	normal,
+	// World position of the camera hit
+	position,
+	// Distance from the camera to the hit
+	depth,
+	// Top level geometry hit, the instance for instanced geometries
+	geomid,
+	primid,
+	// Emission reached in at most one bounce and the rest of the beauty
+	direct,
+	indirect,
+	samples
+};
+
+// Returns false on unknown names
+bool parse_aov(const std::string& name, AovType& type);
+
+// What a camera sample found at its first hit, filled by the integrators
+class AovSample
+{
+public:
+	bool		hit;
+	Vec3f		albedo;
+	Vec3f		normal;
+	Vec3f		position;
+	float		depth;
+	unsigned	geomid;
+	unsigned	primid;
+	Vec3f		direct;
+};
+
+/*
+ * Per pixel sums of the selected AOVs, box filtered. Only the channels
+ *  asked for are stored. Pixels are not shared between tiles, so the
+ *  thread rendering a tile adds to them without synchronization.
+ */
+class AovBuffer
+{
+public:
+	AovBuffer();
+
+	void configure
+	(
+		const std::vector<AovType>& aovs,
+		const unsigned width,
+		const unsigned height
+	);
+	void clear();
+	bool empty() const;
+
+	unsigned nchannels() const;
+	// EXR channel names, in resolved order
+	std::vector<std::string> channel_names() const;
+	// Channels holding uint32 ids rather than floats
+	std::vector<bool> id_channels() const;
+
+	// li is the beauty of the sample, black when it is invalid
+	void add(const size_t pixel, const AovSample& s, const Vec3f& li);
+	// Writes nchannels() values per pixel, pixels are stride floats apart
+	//  and rows row_stride floats apart. The id channels get the bits of
+	//  the uint32 id, ~0 where nothing was hit.
+	void resolve
+	(
+		const OIIO::ROI& roi,
+		float* out,
+		const size_t stride,
+		const size_t row_stride
+	) const;
+	// A single AOV of a region, packed. Returns false when it is not
+	//  rendered.
+	bool resolve(const AovType type, const OIIO::ROI& roi, float* out) const;
+
+private:
+	std::vector<AovType>	aovs;
+	// Where each AOV starts in the sums of a pixel, or in its ids
+	std::vector<unsigned>	offsets;
+	unsigned				width;
+	unsigned				height;
+	// Floats per pixel: the hit and sample counts, then the sums
+	unsigned				pixel_floats;
+	std::vector<float>		sums;
+	// Ids are kept apart, floats lose them past 2^24
+	unsigned				pixel_ids;
+	std::vector<uint32_t>	ids;
+
+	// Writes the channels of the k-th AOV of a pixel, returns where the
+	//  next ones go
+	float* resolve_pixel(const size_t k, const size_t pixel, float* out) const;
+};
+
+#endif
@@ -30,18 +30,6 @@ Vec2f film_space(
 	return{fs[0], (1-fs[1])};
 }
 
-Vec3f hemisphere_sampling(Rand& rand, const Vec3f& n)
-{
-	const auto r0 = rand();
-	const auto r1 = rand();
-	const auto z = std::sqrt(r0);
-    const auto r = std::sqrt(1 - z * z);
-    const auto phi = 2 * PI * r1;
-
-	const auto m = refFromVec(n);
-	return transformVector(m, {z, r * std::cos(phi), r * std::sin(phi)});
-}
-
 bool valid(const Vec3f& li)
 {
 	return
@@ -52,6 +40,19 @@ bool valid(const Vec3f& li)
 	);
 }
 
+float PixelAccumulator::error() const
+{
+	if(samples < 2) return INFINITY;
+	const float mean = lum_sum / samples;
+	const float var = std::max(0.0f, (lum_sum2 - mean*lum_sum) / (samples-1));
+	return std::sqrt(var / samples) / (mean + 1e-3f);
+}
+
+float luminance(const Vec3f& c)
+{
+	return 0.2126f*c[0] + 0.7152f*c[1] + 0.0722f*c[2];
+}
+
 Image::Image(const OIIO::ImageSpec& spec) :
 OIIO::ImageBuf(spec)
 {
@@ -60,277 +61,1136 @@ OIIO::ImageBuf(spec)
 	size  = end - begin;
 }
 
-RTCDevice initialize_embree_device()
-{
-	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
-	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
-	return rtcNewDevice("verbose=3");
+unsigned render_threads
+(
+	const DeviceSettings& settings,
+	const CpuTopology& topology
+) {
+	unsigned nthreads = settings.threads ? settings.threads : thread_budget();
+	if(settings.pin == PinPolicy::cores && topology.ncores > 0)
+		nthreads = std::min(nthreads, topology.ncores);
+	return nthreads;
 }
 
-Bouncer::Bouncer(const boost::filesystem::path& scenepath)
-	: nthreads(std::thread::hardware_concurrency())
-	, embree_device(initialize_embree_device()) 
-	, scene(scenepath, embree_device)
+Bouncer::Bouncer
+(
+	const boost::filesystem::path& scenepath,
+	const DeviceSettings& device_settings,
+	const nlohmann::json& render_overrides
+)
+	: nthreads(render_threads(device_settings, topology))
+	, embree_device(initialize_embree_device(device_settings, nthreads)) 
+	, scene(scenepath, embree_device, nthreads, render_overrides)
+	, built_settings(scene.render_settings)
+	, built_camera(scene.camera)
 	, gatherer(nthreads, "./renderdata")
 	, out_image(OIIO::ImageSpec(
 		scene.render_settings.width,
 		scene.render_settings.height,
 		3, OIIO::TypeDesc::FLOAT
 	))
-{}
+	, accumulation(out_image.size[0] * out_image.size[1])
+	, thread_cpus(topology.placement(device_settings.pin, nthreads))
+	, primary_stats(nthreads)
+	, path_queues(nthreads)
+	, crop(OIIO::ROI::All())
+	, pool(nthreads, thread_cpus)
+{
+	framebuffer.resize(out_image.size[0], out_image.size[1]);
+	topology.log();
+	if(!thread_cpus.empty())
+	{
+		std::ostringstream cpus;
+		for(unsigned ti = 0; ti < nthreads; ++ti)
+			cpus << (ti ? "," : "") << thread_cpus[ti];
+		BOOST_LOG_TRIVIAL(info) << "Pinning " << nthreads << 
+			" render threads to CPUs " << cpus.str();
+	}
+
+	// First touch of the per thread state on the node of its worker
+	pool.run([this](const unsigned ti)
+	{
+		const RenderSettings& rs = scene.render_settings;
+		primary_stats[ti].reset(new PrimaryStats);
+		if(rs.engine == Engine::wavefront)
+			path_queues[ti].reserve(rs.wavefront_paths, rs.max_depth);
+	});
+}
 
 Bouncer::~Bouncer()
 {
 	rtcReleaseDevice(embree_device);
 }
 
-void Bouncer::render()
+RenderSettings& Bouncer::settings()
+{
+	return scene.render_settings;
+}
+
+Camera& Bouncer::camera()
+{
+	return scene.camera;
+}
+
+void Bouncer::set_crop(const OIIO::ROI& roi)
+{
+	crop = roi;
+}
+
+void Bouncer::stream_to(const boost::filesystem::path& imagepath)
+{
+	stream_path = imagepath;
+}
+
+OIIO::ROI Bouncer::render_region() const
+{
+	OIIO::ROI region
+	(
+		out_image.xbegin(), out_image.xend(),
+		out_image.ybegin(), out_image.yend()
+	);
+	if(crop.defined())
+	{
+		region.xbegin = std::max(region.xbegin, crop.xbegin);
+		region.xend   = std::max(region.xbegin, std::min(region.xend, crop.xend));
+		region.ybegin = std::max(region.ybegin, crop.ybegin);
+		region.yend   = std::max(region.ybegin, std::min(region.yend, crop.yend));
+	}
+	return region;
+}
+
+void Bouncer::check_load_settings() const
 {
-	std::vector<std::thread> threads(nthreads);
-	const Vec2f roi_size
+	const RenderSettings& rs = scene.render_settings;
+	const RenderSettings& ls = built_settings;
+	if
+	(
+		rs.build_quality != ls.build_quality ||
+		rs.compact != ls.compact ||
+		rs.robust != ls.robust
+	) {
+		BOOST_LOG_TRIVIAL(warning) << 
+			"The BVH keeps the build settings of the scene load";
+	}
+	if(!scene.view_dependent) return;
+
+	// The inputs of the tessellation rates
+	const Vec3f moved = scene.camera.position() - built_camera.position();
+	if
+	(
+		rs.tessellation_pixels != ls.tessellation_pixels ||
+		rs.max_tessellation_rate != ls.max_tessellation_rate ||
+		dot(moved, moved) > 0 ||
+		scene.camera.pixel_footprint(rs.height) != 
+			built_camera.pixel_footprint(ls.height)
+	) {
+		BOOST_LOG_TRIVIAL(warning) << "Subdivision surfaces keep the " <<
+			"tessellation of the camera and settings of the scene load, " <<
+			"reload the scene to update it";
+	}
+}
+
+void Bouncer::render(const PassCallback& on_pass)
+{
+	check_load_settings();
+	const RenderSettings& rs = scene.render_settings;
+	const AdaptiveSettings& as = rs.adaptive;
+	// Time limited renders start small and grow their passes
+	const unsigned pass_spp = 
+		rs.pass_spp != 0  ? rs.pass_spp : 
+		as.enabled        ? as.min_spp  : 
+		rs.time_limit > 0 ? 1 : rs.spp;
+
+	if
+	(
+		(unsigned)out_image.size[0] != rs.width || 
+		(unsigned)out_image.size[1] != rs.height
+	) {
+		BOOST_LOG_TRIVIAL(info) << 
+			"Resizing the image to " << rs.width << "x" << rs.height;
+		out_image = Image(OIIO::ImageSpec
+		(
+			rs.width, rs.height, 3, OIIO::TypeDesc::FLOAT
+		));
+		accumulation.assign(rs.width * rs.height, PixelAccumulator{});
+		framebuffer.resize(rs.width, rs.height);
+	}
+	framebuffer.set_filter(rs.filter);
+	framebuffer.clear();
+	// The denoiser is guided by AOVs, which are then written as well
+	std::vector<AovType> aovs = rs.aovs;
+	if(rs.denoise.enabled)
+	{
+		for(const AovType guide : {AovType::albedo, AovType::normal})
+		{
+			if(std::find(aovs.begin(), aovs.end(), guide) == aovs.end())
+				aovs.push_back(guide);
+		}
+	}
+	aov_buffer.configure(aovs, rs.width, rs.height);
+
+	// Pixels outside the region stay inactive and black
+	const OIIO::ROI region = render_region();
+	const unsigned width = out_image.size[0];
+	std::fill(accumulation.begin(), accumulation.end(), PixelAccumulator{});
+	for(size_t p = 0; p < accumulation.size(); ++p)
 	{
-		out_image.size[0] / nthreads,
-		out_image.size[1]
+		const int x = out_image.xbegin() + p % width;
+		const int y = out_image.ybegin() + p / width;
+		accumulation[p].active = 
+			x >= region.xbegin && x < region.xend &&
+			y >= region.ybegin && y < region.yend;
+	}
+	for(std::unique_ptr<PrimaryStats>& ps : primary_stats) *ps = PrimaryStats{};
+
+	// Adaptive sampling redistributes the same total sample count
+	const size_t npixels = 
+		size_t(region.xend - region.xbegin) * (region.yend - region.ybegin);
+	if(npixels == 0)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Empty render region";
+		return;
+	}
+	const size_t budget = (size_t)rs.spp * npixels;
+	size_t samples = 0;
+	size_t nactive = npixels;
+	float mean_error = INFINITY;
+
+	// Tiles are only streamed when the last pass is known in advance, the
+	//  other renders write the stream path once done
+	const bool streamable = 
+		!as.enabled && !rs.denoise.enabled && rs.time_limit <= 0;
+	stats = RenderStats{};
+	stats.time_limit = std::max(rs.time_limit, 0.0f);
+	std::unique_ptr<TileWriter> writer;
+	if(!stream_path.empty() && streamable)
+	{
+		// The header is written first, with the planned sample count
+		stats.min_spp = stats.max_spp = rs.spp;
+		stats.mean_spp = rs.spp;
+		writer.reset(new TileWriter
+		(
+			stream_path, out_image.size[0], out_image.size[1], region,
+			rs.tile_size, framebuffer, aov_buffer, rs.output, stats, nthreads
+		));
+	}
+
+	// Time budget: the slowest sample rate, callback and checkpoint write
+	//  so far decide whether another pass fits, along with the denoising
+	//  and the write of the denoised image that follow the last one
+	const auto render_start = std::chrono::steady_clock::now();
+	auto seconds_since = [](const std::chrono::steady_clock::time_point t)
+	{
+		const std::chrono::duration<double> elapsed = 
+			std::chrono::steady_clock::now() - t;
+		return elapsed.count();
 	};
-	for(unsigned ti = 0; ti < nthreads; ++ti)
+	double sample_seconds = 0;
+	double callback_seconds = 0;
+	double checkpoint_seconds = 0;
+	const double denoise_seconds = 
+		rs.time_limit > 0 && rs.denoise.enabled ? estimate_denoise() : 0;
+	// The stream path holds the image of the last pass
+	bool checkpointed = false;
+	unsigned last_spp = 0;
+
+	unsigned pass = 0;
+	while(nactive > 0)
+	{
+		size_t wanted = (as.enabled && pass == 0) ? as.min_spp : pass_spp;
+		if(rs.time_limit > 0 && pass > 0)
+		{
+			// Passes double unless their size is set
+			if(rs.pass_spp == 0) wanted = std::max<size_t>(wanted, 2*last_spp);
+			const double finish_seconds = rs.denoise.enabled ?
+				denoise_seconds + std::max(callback_seconds, checkpoint_seconds) : 0;
+			const double left = rs.time_limit - rs.time_margin - 
+				callback_seconds - checkpoint_seconds - finish_seconds - 
+				seconds_since(render_start);
+			const size_t affordable = 
+				left > 0 ? size_t(left / std::max(sample_seconds*nactive, 1e-9)) : 0;
+			if(affordable == 0)
+			{
+				BOOST_LOG_TRIVIAL(info) << 
+					"Time budget reached after pass #" << pass;
+				break;
+			}
+			wanted = std::min(wanted, affordable);
+		}
+		const unsigned spp = std::min(wanted, (budget - samples) / nactive);
+		if(spp == 0) break;
+
+		// Without adaptive sampling the last pass is known in advance and
+		//  its tiles are final as soon as they and their neighbours are done,
+		//  unless the whole image is denoised afterwards
+		const bool last = 
+			streamable && budget - samples - spp*nactive < nactive;
+		const auto pass_start = std::chrono::steady_clock::now();
+		const size_t pass_first_sample = samples;
+		render_pass(spp, last ? writer.get() : nullptr);
+		++pass;
+		last_spp = spp;
+
+		nactive = update_active_pixels(samples, mean_error);
+		sample_seconds = std::max
+		(
+			sample_seconds,
+			seconds_since(pass_start) / 
+				std::max<size_t>(samples - pass_first_sample, 1)
+		);
+		stats.passes = pass;
+		stats.mean_spp = float(samples) / npixels;
+		stats.seconds = seconds_since(render_start);
+		BOOST_LOG_TRIVIAL(info) << "Pass #" << pass << " done (" << 
+			samples / npixels << "/" << rs.spp << " spp, " << 
+			nactive << " active pixels, mean error " << mean_error << ")";
+
+		// Time limited renders may be cut short by the next pass, and they
+		//  learn what the final write costs
+		if(rs.time_limit > 0 && !writer && !stream_path.empty())
+		{
+			const auto write_start = std::chrono::steady_clock::now();
+			writeimage(stream_path);
+			checkpoint_seconds = 
+				std::max(checkpoint_seconds, seconds_since(write_start));
+			checkpointed = true;
+		}
+
+		const auto callback_start = std::chrono::steady_clock::now();
+		const bool go_on = !on_pass || on_pass(pass, samples / npixels);
+		callback_seconds = std::max(callback_seconds, seconds_since(callback_start));
+		if(!go_on)
+		{
+			BOOST_LOG_TRIVIAL(info) << "Render stopped after pass #" << pass;
+			break;
+		}
+
+		if(as.enabled && mean_error <= as.noise_target)
+		{
+			BOOST_LOG_TRIVIAL(info) << "Noise target reached";
+			break;
+		}
+	}
+	if(rs.denoise.enabled)
+	{
+		denoise();
+		stats.denoised = true;
+		checkpointed = false;
+	}
+	stats.seconds = seconds_since(render_start);
+	if(writer) 
+		writer->close();
+	else if(!stream_path.empty() && !checkpointed)
+		writeimage(stream_path);
+
+	PrimaryStats total;
+	for(const std::unique_ptr<PrimaryStats>& ps : primary_stats)
+	{
+		total.rays += ps->rays;
+		total.seconds += ps->seconds;
+	}
+	BOOST_LOG_TRIVIAL(info) << "Primary rays: " << total.rays << " traced at " <<
+		(total.seconds > 0 ? 1e-6 * total.rays / total.seconds : 0) <<
+		" Mrays/s per thread (" << 
+		(
+			rs.engine == Engine::wavefront ? "wavefront streams" :
+			rs.packets ? "8-wide packets" : "single rays"
+		) << ")";
+}
+
+void Bouncer::render_pass(const unsigned pixel_samples, TileWriter* writer)
+{
+	TileScheduler scheduler
+	(
+		render_region(), scene.render_settings.tile_size, nthreads
+	);
+	BOOST_LOG_TRIVIAL(info) << "Rendering " << scheduler.tilecount() << 
+		" tiles of " << scene.render_settings.tile_size << "px";
+
+	pool.run([this, &scheduler, pixel_samples, writer](const unsigned ti)
+	{
+		render_tiles(scheduler, pixel_samples, writer, ti);
+	});
+}
+
+size_t Bouncer::update_active_pixels(size_t& samples, float& mean_error)
+{
+	const RenderSettings& rs = scene.render_settings;
+	const AdaptiveSettings& as = rs.adaptive;
+
+	const OIIO::ROI region = render_region();
+	const unsigned width = out_image.size[0];
+
+	size_t nactive = 0;
+	size_t npixels = 0;
+	samples = 0;
+	mean_error = 0;
+	stats.min_spp = ~0u;
+	stats.max_spp = 0;
+	for(int y = region.ybegin; y < region.yend; ++y)
+	for(int x = region.xbegin; x < region.xend; ++x)
+	{
+		PixelAccumulator& px = accumulation
+		[
+			(y - out_image.ybegin())*width + (x - out_image.xbegin())
+		];
+		const float error = px.error();
+		if(as.enabled)
+		{
+			px.active = px.samples < as.max_spp && error > as.threshold;
+		}
+		else
+		{
+			px.active = px.samples < rs.spp;
+		}
+		nactive += px.active;
+		samples += px.samples;
+		stats.min_spp = std::min(stats.min_spp, px.samples);
+		stats.max_spp = std::max(stats.max_spp, px.samples);
+		mean_error += std::min(error, 1.0f);
+		++npixels;
+	}
+	mean_error /= std::max<size_t>(npixels, 1);
+	return nactive;
+}
+
+void Bouncer::denoise()
+{
+	const DenoiseSettings& ds = scene.render_settings.denoise;
+	const OIIO::ROI region = render_region();
+	const size_t nvalues = 
+		size_t(region.xend - region.xbegin)*(region.yend - region.ybegin)*3;
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<float> color(nvalues);
+	std::vector<float> albedo(nvalues);
+	std::vector<float> normal(nvalues);
+	const OIIO::ROI fb_region
+	(
+		region.xbegin - out_image.xbegin(), region.xend - out_image.xbegin(),
+		region.ybegin - out_image.ybegin(), region.yend - out_image.ybegin()
+	);
+	const size_t row = size_t(region.xend - region.xbegin)*3;
+	framebuffer.resolve(fb_region, color.data(), 3, row);
+	aov_buffer.resolve(AovType::albedo, fb_region, albedo.data());
+	aov_buffer.resolve(AovType::normal, fb_region, normal.data());
+
+	Denoiser denoiser
+	(
+		ds, fb_region, std::move(color), std::move(albedo), std::move(normal)
+	);
+	for(unsigned i = 0; i < ds.iterations; ++i)
 	{
-		const Vec2f begin{out_image.begin[0] + ti*roi_size[0], 0};
-		const Vec2f end  {begin + roi_size};
-		OIIO::ROI roi(begin[0], end[0], begin[1], end[1]);
-		threads[ti] = std::thread
+		TileScheduler scheduler
 		(
-			&Bouncer::render_roi, 
-			this, roi, ti
+			fb_region, scene.render_settings.tile_size, nthreads
 		);
+		pool.run([&scheduler, &denoiser, i](const unsigned ti)
+		{
+			OIIO::ROI tile;
+			while(scheduler.next(ti, tile)) denoiser.filter(tile, i);
+		});
+		denoiser.swap();
 	}
+	framebuffer.load(fb_region, denoiser.result().data());
+
+	const std::chrono::duration<double> elapsed = 
+		std::chrono::steady_clock::now() - start;
+	BOOST_LOG_TRIVIAL(info) << "Denoised in " << elapsed.count() << 
+		"s (" << ds.iterations << " iterations)";
+}
+
+double Bouncer::estimate_denoise() const
+{
+	const DenoiseSettings& ds = scene.render_settings.denoise;
+	const OIIO::ROI region = render_region();
+	const size_t npixels = 
+		size_t(region.xend - region.xbegin)*(region.yend - region.ybegin);
+	const OIIO::ROI probe
+	(
+		0, std::min(region.xend - region.xbegin, 64),
+		0, std::min(region.yend - region.ybegin, 64)
+	);
+	const size_t probe_pixels = 
+		size_t(probe.xend - probe.xbegin)*(probe.yend - probe.ybegin);
+	if(probe_pixels == 0) return 0;
+
+	// The filter costs the same whatever the pixels hold
+	const auto start = std::chrono::steady_clock::now();
+	Denoiser denoiser
+	(
+		ds, probe,
+		std::vector<float>(probe_pixels*3), 
+		std::vector<float>(probe_pixels*3), 
+		std::vector<float>(probe_pixels*3)
+	);
+	denoiser.filter(probe, 0);
+	const std::chrono::duration<double> elapsed = 
+		std::chrono::steady_clock::now() - start;
 
-	for(unsigned ti = 0; ti < nthreads; ++ti) threads[ti].join();
+	// Iterations run on every thread, the resolve and load around them
+	//  count as one more
+	const double seconds = 
+		elapsed.count() / probe_pixels * npixels * (ds.iterations + 1) / nthreads;
+	BOOST_LOG_TRIVIAL(info) << "Denoising expected to take " << seconds << "s";
+	return seconds;
+}
+
+const Image& Bouncer::image()
+{
+	framebuffer.resolve(out_image);
+	return out_image;
 }
 
 void Bouncer::writeimage(const boost::filesystem::path& imagepath)
 {
-	out_image.write(imagepath.string());
+	if(!TileWriter::supports_tiles(imagepath))
+	{
+		if(!aov_buffer.empty())
+		{
+			BOOST_LOG_TRIVIAL(warning) << "\"" << imagepath.string() << 
+				"\" only gets the beauty, AOVs need a tiled format";
+		}
+		set_metadata(out_image.specmod(), stats);
+		image().write(imagepath.string());
+		return;
+	}
+	const RenderSettings& rs = scene.render_settings;
+	TileWriter writer
+	(
+		imagepath, out_image.size[0], out_image.size[1], render_region(),
+		rs.tile_size, framebuffer, aov_buffer, rs.output, stats, nthreads
+	);
+	writer.close();
+}
+
+void Bouncer::render_tiles(
+	TileScheduler& scheduler,
+	const unsigned pixel_samples,
+	TileWriter* writer,
+	const unsigned thread_id
+) {
+	BOOST_LOG_TRIVIAL(info) << "Render thread #" << thread_id << " started";
+
+	unsigned ntiles = 0;
+	OIIO::ROI tile;
+	while(scheduler.next(thread_id, tile))
+	{
+		if(scene.render_settings.engine == Engine::wavefront)
+		{
+			render_roi_wavefront(tile, pixel_samples, thread_id);
+		}
+		else
+		{
+			render_roi(tile, pixel_samples, thread_id);
+		}
+		if(writer) writer->tile_done(tile);
+		++ntiles;
+	}
+
+	BOOST_LOG_TRIVIAL(info) << 
+		"Render thread #" << thread_id << " done (" << ntiles << " tiles)";
 }
 
 void Bouncer::render_roi(
 	const OIIO::ROI roi, 
+	const unsigned pixel_samples,
 	const unsigned thread_id
 ) {
 	RTCIntersectContext intersect_context;
 	rtcInitIntersectContext(&intersect_context);
+	// Camera rays of a tile are highly coherent
+	RTCIntersectContext coherent_context;
+	rtcInitIntersectContext(&coherent_context);
+	coherent_context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
 	
-	Rand rand;
-	
-	const unsigned pixel_samples = scene.render_settings.spp;
-	const unsigned bounces = 4;
+	const unsigned width = out_image.size[0];
+	const unsigned max_samples = scene.render_settings.adaptive.enabled ?
+		scene.render_settings.adaptive.max_spp :
+		scene.render_settings.spp;
 
-	BOOST_LOG_TRIVIAL(info) << "Render thread #" << thread_id << " started";
+	PrimaryBatch batch;
+	for(int y = roi.ybegin; y < roi.yend; ++y)
+	for(int x = roi.xbegin; x < roi.xend; ++x)
+	{
+		const unsigned pixel = 
+			(y - out_image.ybegin())*width + (x - out_image.xbegin());
+		PixelAccumulator& px = accumulation[pixel];
+		if(!px.active) continue;
 
-	for
-	(
-		OIIO::ImageBuf::Iterator<float> it(out_image, roi); 
-		!it.done(); ++it
-	) {
-		const Vec2f xy  {(float)it.x(), (float)it.y()}; 
-		Vec3f c{};
-		for(unsigned s = 0; s < pixel_samples; ++s)
+		const unsigned nsamples = 
+			std::min(pixel_samples, max_samples - px.samples);
+
+		const Vec2f xy  {(float)x, (float)y}; 
+		for(unsigned s = 0; s < nsamples; ++s)
 		{
-			const Vec2f pixel_uv{rand(),        rand()};
-			const Vec2f uv = film_space(xy, pixel_uv, out_image);
-			RTCRay r = scene.camera.generate_ray(uv);
-
-			//BOOST_LOG_TRIVIAL(info) << xy[0] << " " << xy[1] << " | " << pixel_uv[0] << " " << pixel_uv[1] << " | " << uv[0] << " " << uv[1];
-
-			const Vec3f li = estimate_li
-				(r, &intersect_context, bounces, rand, thread_id);
-
-			gatherer.finalizepath(
-				thread_id, 
-				fromVec3f(li),
-				{
-					(uint16_t)xy[0], (uint16_t)xy[1],
-					(half)pixel_uv[0], (half)pixel_uv[1]
-				}
+			const unsigned l = batch.count++;
+			const Sampler& sampler = batch.samplers[l] = Sampler
+			(
+				scene.render_settings.sampler, 
+				pixel, px.samples + s, scene.render_settings.seed
 			);
+			batch.pixels[l]   = &px;
+			batch.xy[l]       = xy;
+			batch.pixel_uv[l] = sampler.pixel();
+			batch.film_uv[l]  = film_space(xy, batch.pixel_uv[l], out_image);
 
-			if(valid(li))
+			if(batch.count == PrimaryBatch::size)
 			{
-				c = c + li;
+				trace_primary
+				(
+					batch, &coherent_context, &intersect_context, thread_id
+				);
 			}
 		}
-		c = c / pixel_samples;
-		it[0] = c[0];
-		it[1] = c[1];
-		it[2] = c[2];
 	}
+	if(batch.count > 0)
+	{
+		trace_primary
+		(
+			batch, &coherent_context, &intersect_context, thread_id
+		);
+	}
+}
+
+void Bouncer::trace_primary(
+	PrimaryBatch& batch,
+	RTCIntersectContext* coherent,
+	RTCIntersectContext* incoherent,
+	const unsigned thread_id
+) {
+	RTCRayHit rhs[PrimaryBatch::size];
+
+	const auto start = std::chrono::steady_clock::now();
+	if(scene.render_settings.packets)
+	{
+		alignas(32) RTCRayHit8 rh8;
+		alignas(32) int valid8[8];
+		scene.camera.generate_ray8(batch.film_uv, batch.count, rh8.ray);
+		for(unsigned l = 0; l < 8; ++l)
+		{
+			valid8[l] = l < batch.count ? -1 : 0;
+			rh8.hit.geomID[l] = RTC_INVALID_GEOMETRY_ID;
+		}
+		rtcIntersect8(valid8, scene.embree_scene, coherent, &rh8);
+
+		for(unsigned l = 0; l < batch.count; ++l)
+		{
+			RTCRay& r = rhs[l].ray;
+			r.org_x = rh8.ray.org_x[l];
+			r.org_y = rh8.ray.org_y[l];
+			r.org_z = rh8.ray.org_z[l];
+			r.tnear = rh8.ray.tnear[l];
+			r.dir_x = rh8.ray.dir_x[l];
+			r.dir_y = rh8.ray.dir_y[l];
+			r.dir_z = rh8.ray.dir_z[l];
+			r.time  = rh8.ray.time[l];
+			r.tfar  = rh8.ray.tfar[l];
+			r.mask  = rh8.ray.mask[l];
+			r.id    = rh8.ray.id[l];
+			r.flags = rh8.ray.flags[l];
+
+			RTCHit& h = rhs[l].hit;
+			h.Ng_x      = rh8.hit.Ng_x[l];
+			h.Ng_y      = rh8.hit.Ng_y[l];
+			h.Ng_z      = rh8.hit.Ng_z[l];
+			h.u         = rh8.hit.u[l];
+			h.v         = rh8.hit.v[l];
+			h.primID    = rh8.hit.primID[l];
+			h.geomID    = rh8.hit.geomID[l];
+			h.instID[0] = rh8.hit.instID[0][l];
+		}
+	}
+	else
+	{
+		// Traced as before packets, the reference the rays/s are compared to
+		for(unsigned l = 0; l < batch.count; ++l)
+		{
+			rhs[l] = {scene.camera.generate_ray(batch.film_uv[l]), {}};
+			rhs[l].hit.geomID = RTC_INVALID_GEOMETRY_ID;
+			rtcIntersect1(scene.embree_scene, incoherent, &rhs[l]);
+		}
+	}
+	const std::chrono::duration<double> elapsed = 
+		std::chrono::steady_clock::now() - start;
+	primary_stats[thread_id]->rays += batch.count;
+	primary_stats[thread_id]->seconds += elapsed.count();
+
+	const bool aovs = !aov_buffer.empty();
+	for(unsigned l = 0; l < batch.count; ++l)
+	{
+		AovSample* aov = aovs ? &batch.aovs[l] : nullptr;
+		const Vec3f li = estimate_li
+			(rhs[l], incoherent, batch.samplers[l], aov, thread_id);
+		finalize_sample
+		(
+			*batch.pixels[l], li, batch.xy[l], batch.pixel_uv[l], aov, thread_id
+		);
+	}
+	batch.count = 0;
+}
+
+void Bouncer::finalize_sample(
+	PixelAccumulator& px,
+	const Vec3f& li,
+	const Vec2f& xy,
+	const Vec2f& pixel_uv,
+	const AovSample* aov,
+	const unsigned thread_id
+) {
+	gatherer.finalizepath(
+		thread_id, 
+		fromVec3f(li),
+		{
+			(uint16_t)xy[0], (uint16_t)xy[1],
+			(half)pixel_uv[0], (half)pixel_uv[1]
+		}
+	);
+
+	// Camera rays that miss count as black samples
+	const Vec3f c = valid(li) ? li : Vec3f{};
+	framebuffer.splat(xy - out_image.begin + pixel_uv, c);
+	if(aov) aov_buffer.add(&px - accumulation.data(), *aov, c);
+
+	if(valid(li))
+	{
+		const float lum = luminance(li);
+		px.lum_sum  += lum;
+		px.lum_sum2 += lum*lum;
+	}
+	++px.samples;
+}
+
+float max_component(const Vec3f& v)
+{
+	return std::max(v[0], std::max(v[1], v[2]));
+}
+
+void first_hit
+(
+	const RTCRayHit& rh,
+	const SurfaceHit& sh,
+	const Material& mat,
+	AovSample& aov
+) {
+	aov.hit = true;
+	aov.albedo = mat.albedo;
+	aov.normal = sh.n;
+	aov.position = sh.p;
+	// Camera rays are normalized
+	aov.depth = rh.ray.tfar;
+	// Instances are top level geometries of their own
+	aov.geomid = rh.hit.instID[0] != RTC_INVALID_GEOMETRY_ID ? 
+		rh.hit.instID[0] : rh.hit.geomID;
+	aov.primid = rh.hit.primID;
+}
+
+// Veach's power heuristic with beta = 2
+float power_heuristic(const float pdf_a, const float pdf_b)
+{
+	const float a2 = pdf_a*pdf_a;
+	const float b2 = pdf_b*pdf_b;
+	return a2 > 0 ? a2 / (a2 + b2) : 0;
+}
+
+SurfaceHit Bouncer::surface(const RTCRayHit& rh)
+{
+	if(const TangentFrame* frame = scene.frame(rh.hit))
+		return surface_cached(rh, *frame);
+	return surface_interpolated(rh);
+}
+
+SurfaceHit Bouncer::surface_cached
+(
+	const RTCRayHit& rh, 
+	const TangentFrame& frame
+) {
+	SurfaceHit sh;
+	sh.i  = Vec3f{rh.ray.dir_x, rh.ray.dir_y, rh.ray.dir_z};
+	sh.p  = Vec3f{rh.ray.org_x, rh.ray.org_y, rh.ray.org_z} + rh.ray.tfar*sh.i;
+	if(const Instance* inst = scene.instance(rh.hit))
+	{
+		sh.dpdu	= inst->vector(frame.dpdu);
+		sh.dpdv	= inst->vector(frame.dpdv);
+		sh.ng	= normalize(cross(sh.dpdu, sh.dpdv));
+	}
+	else
+	{
+		sh.dpdu	= frame.dpdu;
+		sh.dpdv	= frame.dpdv;
+		sh.ng	= frame.ng;
+	}
+	sh.n  = dot(sh.ng, sh.i) > 0 ? -1*sh.ng : sh.ng;
+	return sh;
+}
+
+SurfaceHit Bouncer::surface_interpolated(const RTCRayHit& rh)
+{
+	SurfaceHit sh;
+	RTCInterpolateArguments ia;
+	ia.geometry		= scene.geometry(rh.hit);
+	ia.primID		= rh.hit.primID;
+	ia.u			= rh.hit.u;
+	ia.v			= rh.hit.v;
+	ia.bufferType	= RTC_BUFFER_TYPE_VERTEX;
+	ia.bufferSlot	= 0;
+	ia.P			= (float*)(&sh.p);
+	ia.dPdu			= (float*)(&sh.dpdu);
+	ia.dPdv			= (float*)(&sh.dpdv);
+	ia.ddPdudu		= nullptr;
+	ia.valueCount	= 3;
+	rtcInterpolate(&ia);
+
+	// Prototypes are interpolated in object space
+	if(const Instance* inst = scene.instance(rh.hit))
+	{
+		sh.p	= inst->point(sh.p);
+		sh.dpdu	= inst->vector(sh.dpdu);
+		sh.dpdv	= inst->vector(sh.dpdv);
+	}
+
+	sh.i  = Vec3f{rh.ray.dir_x, rh.ray.dir_y, rh.ray.dir_z};
+	sh.ng = normalize(cross(sh.dpdu, sh.dpdv));
+	// Shading happens on the side the ray comes from
+	sh.n  = dot(sh.ng, sh.i) > 0 ? -1*sh.ng : sh.ng;
+	return sh;
+}
+
+void Bouncer::benchmark_frames()
+{
+	RTCIntersectContext ic;
+	rtcInitIntersectContext(&ic);
+
+	std::vector<RTCRayHit> hits;
+	for(int y = out_image.ybegin(); y < out_image.yend(); ++y)
+	for(int x = out_image.xbegin(); x < out_image.xend(); ++x)
+	{
+		const Vec2f xy({(float)x, (float)y});
+		RTCRayHit rh
+		{
+			scene.camera.generate_ray
+			(
+				film_space(xy, Vec2f({0.5f, 0.5f}), out_image)
+			), 
+			{}
+		};
+		rh.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+		rtcIntersect1(scene.embree_scene, &ic, &rh);
+		if(rh.hit.geomID != RTC_INVALID_GEOMETRY_ID && scene.frame(rh.hit))
+			hits.push_back(rh);
+	}
+	if(hits.empty())
+	{
+		BOOST_LOG_TRIVIAL(warning) << "No camera hit on cached geometry";
+		return;
+	}
+
+	const unsigned repeats = std::max<size_t>(1, (1 << 24) / hits.size());
+	// Summed so that the frames are not optimized away
+	float checksum = 0;
+	auto time = [&](auto&& frame_of)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for(unsigned r = 0; r < repeats; ++r)
+		for(const RTCRayHit& rh : hits)
+		{
+			const SurfaceHit sh = frame_of(rh);
+			checksum += sh.ng[0] + sh.dpdu[1];
+		}
+		const std::chrono::duration<double, std::nano> elapsed = 
+			std::chrono::steady_clock::now() - start;
+		return elapsed.count() / (double(repeats) * hits.size());
+	};
+
+	const double interpolated = time([this](const RTCRayHit& rh)
+	{
+		return surface_interpolated(rh);
+	});
+	const double cached = time([this](const RTCRayHit& rh)
+	{
+		return surface_cached(rh, *scene.frame(rh.hit));
+	});
+
+	BOOST_LOG_TRIVIAL(info) << "Shading frames over " << hits.size() << 
+		" camera hits: " << interpolated << " ns/hit interpolated, " << 
+		cached << " ns/hit cached (checksum " << checksum << ")";
+}
+
+float Bouncer::emission_weight
+(
+	const RTCRayHit& rh,
+	const SurfaceHit& sh,
+	const unsigned depth,
+	const float bsdf_pdf
+) {
+	// Camera rays are not light sampled, all the others are
+	//  weighted against the light sampling strategy.
+	if(depth == 0) return 1;
+
+	const float pdf_area = scene.lights.pdf
+	(
+		rh.hit.geomID, rh.hit.primID, sh.dpdu, sh.dpdv
+	);
+	const float cos_l = std::abs(dot(sh.ng, sh.i));
+	const float pdf_light = cos_l > 0 ?
+		pdf_area * rh.ray.tfar * rh.ray.tfar / cos_l : 0;
+	return power_heuristic(bsdf_pdf, pdf_light);
+}
+
+bool Bouncer::sample_direct
+(
+	const SurfaceHit& sh,
+	const Bsdf& bsdf,
+	const unsigned depth,
+	const Sampler& sampler,
+	RTCRay& shadow,
+	Vec3f& contribution
+) {
+	const float u_light = sampler.bounce(depth, dim_misc)[0];
+	const Vec2f uv = sampler.bounce(depth, dim_light);
+	const LightSample ls = scene.lights.sample(u_light, uv);
+	if(ls.pdf <= 0) return false;
+
+	const Vec3f to_light = ls.p - sh.p;
+	const float dist2 = dot(to_light, to_light);
+	const float dist = std::sqrt(dist2);
+	const Vec3f o = (1/dist)*to_light;
+
+	// Emitters are two-sided, as they are when hit by BSDF sampling
+	const float cos_l = std::abs(dot(ls.n, o));
+	if(cos_l <= 0) return false;
+
+	const Vec3f f = bsdf.eval(o);
+	if(max_component(f) <= 0) return false;
+
+	shadow = ray(sh.p + 0.001f*sh.n, o);
+	shadow.tfar = (1 - 0.001f)*dist;
+
+	const float pdf_light = ls.pdf * dist2 / cos_l;
+	const float weight = power_heuristic(pdf_light, bsdf.pdf(o));
+	contribution = (weight / pdf_light)*(f*ls.emittance);
+	return true;
+}
+
+Vec3f Bouncer::estimate_direct
+(
+	const SurfaceHit& sh,
+	const Bsdf& bsdf,
+	const unsigned depth,
+	RTCIntersectContext* ic,
+	const Sampler& sampler
+) {
+	RTCRay shadow;
+	Vec3f contribution;
+	if(!sample_direct(sh, bsdf, depth, sampler, shadow, contribution))
+		return {};
+
+	rtcOccluded1(scene.embree_scene, ic, &shadow);
+	if(shadow.tfar < 0) return {};
+	return contribution;
+}
+
+bool Bouncer::continue_path
+(
+	const SurfaceHit& sh,
+	const Bsdf& bsdf,
+	const unsigned depth,
+	const Sampler& sampler,
+	Vec3f& throughput,
+	float& bsdf_pdf,
+	RTCRay& next
+) {
+	const Vec2f u = sampler.bounce(depth, dim_bsdf);
+	const Vec3f o = bsdf.sample(u, bsdf_pdf);
+	if(bsdf_pdf <= 0) return false;
+	throughput = throughput * ((1/bsdf_pdf)*bsdf.eval(o));
+
+	// Russian roulette: past rr_depth, paths carrying little energy
+	//  are terminated and the survivors are reweighted.
+	if(depth >= scene.render_settings.rr_depth)
+	{
+		const float survival = std::min(max_component(throughput), 0.95f);
+		if(sampler.bounce(depth, dim_misc)[1] >= survival) return false;
+		throughput = throughput / survival;
+	}
+
+	next = ray(sh.p + 0.001f*sh.n, o);
+	return true;
 }
 
 Vec3f Bouncer::estimate_li
 (
-	RTCRay r, 
+	RTCRayHit& rh, 
 	RTCIntersectContext* ic, 
-	int bounces,
-	Rand& rand,
+	const Sampler& sampler,
+	AovSample* aov,
 	const unsigned thread_id
 ) {
-	RTCRayHit rh{r, {}};
-	rh.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+	const RenderSettings& rs = scene.render_settings;
+	if(aov)
+	{
+		aov->hit = false;
+		aov->direct = Vec3f{};
+	}
 
-	rtcIntersect1(scene.embree_scene, ic, &rh);
+	Vec3f li{};
+	Vec3f throughput{1, 1, 1};
+	// Density of the BSDF sample that generated the current ray
+	float bsdf_pdf = 0;
 
-	if(rh.hit.geomID != RTC_INVALID_GEOMETRY_ID)
+	for(unsigned depth = 0;; ++depth)
 	{
-		RTCGeometry geom = rtcGetGeometry
-		(
-			scene.embree_scene, rh.hit.geomID
-		);
-		Vec3f p, dpdu, dpdv;
-		RTCInterpolateArguments ia;
-		ia.geometry		= geom;
-		ia.primID		= rh.hit.primID;
-		ia.u			= rh.hit.u;
-		ia.v			= rh.hit.v;
-		ia.bufferType	= RTC_BUFFER_TYPE_VERTEX;
-		ia.bufferSlot	= 0;
-		ia.P			= (float*)(&p);
-		ia.dPdu			= (float*)(&dpdu);
-		ia.dPdv			= (float*)(&dpdv);
-		ia.ddPdudu		= nullptr;
-		ia.valueCount	= 3;
-		rtcInterpolate(&ia);
-		const Vec3f n  = normalize(cross(dpdu, dpdv));
-		const Vec3f t  = normalize(dpdu);
-		const Vec3f bt = cross(t, n);
-		const Mat4f n_mat{t, bt, n, {}};
+		if(depth > 0)
+		{
+			rh.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+			rtcIntersect1(scene.embree_scene, ic, &rh);
+		}
+
+		if(rh.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+		{
+			// Camera rays that miss everything are not valid samples
+			return depth == 0 ? Vec3f{-1, -1, -1} : li;
+		}
+
+		const SurfaceHit sh = surface(rh);
 
 		gatherer.addbounce(
 			thread_id, 
-			fromVec3f({r.org_x, r.org_y, r.org_z})
+			fromVec3f({rh.ray.org_x, rh.ray.org_y, rh.ray.org_z})
 		);
 
-		const Material mat = scene.materials[rh.hit.geomID];
-		const Vec3f kd = mat.albedo;
+		const Material& mat = scene.material(rh.hit);
 		const Vec3f ke = mat.emittance;
+		if(aov && depth == 0) first_hit(rh, sh, mat, *aov);
 
-		if(bounces == 0)
+		if(max_component(ke) > 0)
 		{
-			return ke;
+			const float weight = emission_weight(rh, sh, depth, bsdf_pdf);
+			const Vec3f e = weight*(throughput*ke);
+			li = li + e;
+			if(aov && depth <= 1) aov->direct = aov->direct + e;
 		}
-		else
+
+		if(depth == rs.max_depth) break;
+
+		const Bsdf bsdf(sh.n, sh.i, mat);
+
+		if(!scene.lights.empty())
 		{
-			const Vec3f o = hemisphere_sampling(rand, n);
-			RTCRay new_r = ray(p + 0.001f*n, o);
-			const Vec3f li = estimate_li(
-				new_r, ic, bounces-1, rand, thread_id
-			);
-			
-			if(!valid(li))
-			{
-				return ke;
-			}
-			else 
-			{
-				const float alpha_g = 1.0f;
-				const float ior_t = 1.2f;
-				const float ior_i = 1.0f;
-
-				const float xi_1 = rand();
-				const float xi_2 = rand();
-
-				const float alpha2_g = alpha_g*alpha_g;
-
-				const float theta_m_num = alpha_g * sqrt(xi_1);
-				const float theta_m_den = sqrt(1 - xi_1);
-				const float theta_m = atan(theta_m_num / theta_m_den);
-				const float phi_m = 2*PI*xi_2;
-				const float sin_theta_m = sin(theta_m);
-				const float cos_theta_m = cos(theta_m);
-				const Vec3f m_local{
-					sin_theta_m * cos(phi_m),
-					sin_theta_m * sin(phi_m),
-					cos_theta_m
-				};
-				const Vec3f m = transformVector(n_mat, m_local);
-
-				const float lamb_term = abs(dot(n, o));
-
-				const Vec3f i{r.dir_x, r.dir_y, r.dir_z};
-
-				const float i_dot_n = dot(i, n);
-				const float o_dot_n = dot(o, n);
-				const float m_dot_n = dot(m, n);
-				const float i_dot_m = dot(i, m);
-
-
-				const float f_c = abs(i_dot_m);
-				const float ior_frac = (ior_t*ior_t) / (ior_i*ior_i);
-				const float f_g = sqrt(ior_frac - 1 + f_c*f_c);
-				const float g_min_c = f_g - f_c;
-				const float g_plu_c = f_g + f_c;
-				const float g_min_c2 = g_min_c*g_min_c;
-				const float g_plu_c2 = g_plu_c*g_plu_c;
-				const float f_mult1 = g_min_c2/g_plu_c2;
-				const float f_mult2_num1 = (f_c*g_plu_c - 1);
-				const float f_mult2_num = f_mult2_num1*f_mult2_num1;
-				const float f_mult2_den1 = (f_c*g_min_c + 1);
-				const float f_mult2_den = f_mult2_den1*f_mult2_den1;
-				const float f_mult2 = 1 + (f_mult2_num / f_mult2_den);
-				const float f = 0.5f * f_mult1 * f_mult2;
-				/*const float f_u = dot(i, o);
-				const float m1_f_u = 1 - f_u;
-				const float m1_f_u2 = m1_f_u * m1_f_u;
-				const float m1_f_u5 = m1_f_u2 * m1_f_u2 * m1_f_u;
-				const float f_lambda = 0.7f;
-				const float f = f_lambda + (1-f_lambda)*m1_f_u5;*/
-
-
-				const float d_num = alpha2_g*(m_dot_n > 0);
-				const float cos2_theta_m = cos_theta_m*cos_theta_m;
-				const float cos4_theta_m = cos2_theta_m*cos2_theta_m;
-				const float tan_theta_m = sin_theta_m / cos_theta_m;
-				const float tan2_theta_m = tan_theta_m*tan_theta_m;
-				const float alpha2_tan2 = alpha2_g + tan2_theta_m;
-				const float alpha2_tan22 = alpha2_tan2*alpha2_tan2;
-				const float d_den = PI*cos4_theta_m*alpha2_tan22;
-				const float d = d_num / d_den;
-
-
-				float g_i = 0;
-				const float g_i_step = (i_dot_m / i_dot_n) > 0;
-				if(g_i_step > 0)
-				{
-					const float theta_i = acos(i_dot_n);
-					const float tan_theta_i = tan(theta_i);
-					const float tan2_theta_i = tan_theta_i*tan_theta_i;
-					const float g_i_den = 1 + sqrt(1 + alpha2_g*tan2_theta_i);
-					g_i = 2 / g_i_den;
-				}
-
-				float g_o = 0;
-				const float g_o_step = (dot(o, m) / o_dot_n) > 0;
-				if(g_o_step > 0)
-				{
-					const float theta_o = acos(o_dot_n);
-					const float tan_theta_o = tan(theta_o);
-					const float tan2_theta_o = tan_theta_o*tan_theta_o;
-					const float g_o_den = 1 + sqrt(1 + alpha2_g*tan2_theta_o);
-					g_o = 2 / g_o_den;
-				}
-
-				const float g = g_i*g_o;
-
-
-				const float brdf = (g*d)/(4*abs(i_dot_n)*abs(o_dot_n));
-				return ke + (lamb_term*(kd + PI*f*brdf*kd)*li);
-			}
+			const Vec3f d = 
+				throughput*estimate_direct(sh, bsdf, depth, ic, sampler);
+			li = li + d;
+			if(aov && depth == 0) aov->direct = aov->direct + d;
 		}
+
+		if(!continue_path(sh, bsdf, depth, sampler, throughput, bsdf_pdf, rh.ray))
+			break;
 	}
-	return {-1, -1, -1};
+	return li;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-	Bouncer b("../scenes/boxbunny/boxbunny.json");
-	b.render();
-	b.writeimage("boxbunny.exr");
+	boost::filesystem::path scene_path = "../scenes/boxbunny/boxbunny.json";
+	boost::filesystem::path image_path;
+	// Command line settings take precedence over the render block
+	nlohmann::json render_overrides = nlohmann::json::object();
+	DeviceSettings device_settings;
+	bool bench_frames = false;
+
+	auto usage = [&argv]()
+	{
+		std::cerr << "Usage: " << argv[0] << " [scene] [-o image.exr]" <<
+			" [--build-quality low|medium|high] [--compact] [--robust]" <<
+			" [--threads N] [--pin none|compact|scatter|cores]" <<
+			" [--set-affinity] [--isa ISA] [--verbose N]" <<
+			" [--tessellation-cache MB] [--half] [--compression NAME]" <<
+			" [--stream] [--aovs albedo,normal,...] [--[no-]denoise]" <<
+			" [--time-limit SECONDS]" <<
+			" [--bench-frames]\n";
+		return 1;
+	};
+
+	for(int a = 1; a < argc; ++a)
+	{
+		const std::string arg = argv[a];
+		try
+		{
+			if(arg == "--build-quality" && a + 1 < argc)
+				render_overrides["build_quality"] = argv[++a];
+			else if(arg == "--compact")
+				render_overrides["compact"] = true;
+			else if(arg == "--robust")
+				render_overrides["robust"] = true;
+			else if(arg == "--threads" && a + 1 < argc)
+				device_settings.threads = std::stoul(argv[++a]);
+			else if(arg == "--pin" && a + 1 < argc)
+				device_settings.pin = parse_pin_policy(argv[++a]);
+			else if(arg == "--tessellation-cache" && a + 1 < argc)
+				device_settings.tessellation_cache = std::stoul(argv[++a]);
+			else if(arg == "--set-affinity")
+				device_settings.set_affinity = true;
+			else if(arg == "--isa" && a + 1 < argc)
+				device_settings.isa = argv[++a];
+			else if(arg == "--verbose" && a + 1 < argc)
+				device_settings.verbose = std::stoul(argv[++a]);
+			else if(arg == "--half")
+				render_overrides["output"]["precision"] = "half";
+			else if(arg == "--compression" && a + 1 < argc)
+				render_overrides["output"]["compression"] = argv[++a];
+			else if(arg == "--aovs" && a + 1 < argc)
+			{
+				// Comma separated
+				std::istringstream names(argv[++a]);
+				render_overrides["aovs"] = nlohmann::json::array();
+				for(std::string name; std::getline(names, name, ',');)
+					render_overrides["aovs"].push_back(name);
+			}
+			else if(arg == "--denoise")
+				render_overrides["denoise"]["enabled"] = true;
+			else if(arg == "--no-denoise")
+				render_overrides["denoise"]["enabled"] = false;
+			else if(arg == "--time-limit" && a + 1 < argc)
+				render_overrides["time_limit"] = std::stof(argv[++a]);
+			else if(arg == "--stream")
+				render_overrides["output"]["stream"] = true;
+			else if(arg == "--bench-frames")
+				bench_frames = true;
+			else if(arg == "-o" && a + 1 < argc)
+				image_path = argv[++a];
+			else if(arg[0] != '-')
+				scene_path = arg;
+			else
+				return usage();
+		}
+		// std::stoul and std::stof on values that are not numbers
+		catch(const std::logic_error&)
+		{
+			return usage();
+		}
+	}
+	if(image_path.empty())
+		image_path = scene_path.stem().string() + ".exr";
+
+	Bouncer b(scene_path, device_settings, render_overrides);
+	if(bench_frames)
+	{
+		b.benchmark_frames();
+		return 0;
+	}
+	// A streamed image is only complete at the end of the render, it is
+	//  not rewritten after every pass unless the render is time limited
+	if(b.settings().output.stream && TileWriter::supports_tiles(image_path))
+	{
+		b.stream_to(image_path);
+		b.render();
+		return 0;
+	}
+	b.render([&b, &image_path](const unsigned, const unsigned)
+	{
+		b.writeimage(image_path);
+		return true;
+	});
+	// The passes wrote the noisy beauty
+	if(b.settings().denoise.enabled) b.writeimage(image_path);
 }
\ No newline at end of file
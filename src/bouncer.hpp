@@ -2,31 +2,30 @@
 #define _BOUNCER_HPP_
 
 #include "scene.hpp"
+#include "device.hpp"
+#include "sampler.hpp"
+#include "bsdf.hpp"
+#include "scheduler.hpp"
+#include "wavefront.hpp"
+#include "threadpool.hpp"
+#include "framebuffer.hpp"
+#include "tilewriter.hpp"
 #include "gatherer.hpp"
 
-#include <xmmintrin.h>
-#include <pmmintrin.h>
 #include <embree3/rtcore.h>
 
 #include <OpenImageIO/imagebuf.h>
 
 #include <boost/log/trivial.hpp>
 
-#include <random>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
 #include <thread>
 
-class Rand
-{
-public:
-	float operator()()
-	{
-		return dist(mt);
-	}
-private:
-	std::mt19937 							mt;
-	std::uniform_real_distribution<float> 	dist;
-};
-
 class Image : 
 public OIIO::ImageBuf
 {
@@ -37,27 +36,249 @@ public:
 	Vec2f size;
 };
 
+Vec2f film_space
+(
+	const Vec2f  xy,
+	const Vec2f  pixel_space,
+	const Image& image
+);
+float max_component(const Vec3f& v);
+
+// Sampling state of a pixel, its radiance goes to the framebuffer
+class PixelAccumulator
+{
+public:
+	// Luminance sums, used for the online variance estimate
+	float		lum_sum		= 0;
+	float		lum_sum2	= 0;
+	unsigned	samples		= 0;
+	bool		active		= true;
+
+	// Relative standard error of the mean luminance
+	float error() const;
+};
+
+// Local geometry at a ray hit
+class SurfaceHit
+{
+public:
+	Vec3f p;
+	// Direction of the incoming ray
+	Vec3f i;
+	// Normal of the surface parametrization
+	Vec3f ng;
+	// Shading normal, ng flipped towards the incoming ray
+	Vec3f n;
+	Vec3f dpdu;
+	Vec3f dpdv;
+};
+
+// Records the camera hit of a sample
+void first_hit
+(
+	const RTCRayHit& rh,
+	const SurfaceHit& sh,
+	const Material& mat,
+	AovSample& aov
+);
+
+// Camera samples whose rays are traced together
+class PrimaryBatch
+{
+public:
+	static const unsigned	size = 8;
+	unsigned				count = 0;
+	PixelAccumulator*		pixels[size];
+	AovSample				aovs[size];
+	Sampler					samplers[size];
+	Vec2f					xy[size];
+	Vec2f					pixel_uv[size];
+	Vec2f					film_uv[size];
+};
+
+// Primary ray traversal counters of a render thread
+class alignas(64) PrimaryStats
+{
+public:
+	uint64_t	rays	= 0;
+	double		seconds	= 0;
+};
+
+// Called after every progressive pass with the mean number of samples
+//  per pixel taken so far. Bouncer::image() resolves a snapshot.
+// Returning false stops the render after the current pass.
+using PassCallback = std::function<bool
+(
+	const unsigned	pass,
+	const unsigned	spp
+)>;
+
 class Bouncer
 {
 public:
-	Bouncer(const boost::filesystem::path& scenepath);
+	Bouncer
+	(
+		const boost::filesystem::path& scenepath,
+		const DeviceSettings& device_settings = DeviceSettings(),
+		const nlohmann::json& render_overrides = nlohmann::json::object()
+	);
 	~Bouncer();
-	void render();
+	// May be called any number of times, the device, the committed scene
+	//  and the render threads are kept in between
+	void render(const PassCallback& on_pass = nullptr);
+	// Settings and camera of the next renders. The BVH build settings, the
+	//  tessellation settings and the camera the subdivision surfaces are
+	//  tessellated for only apply when the scene is loaded: renders warn
+	//  when they changed since.
+	RenderSettings& settings();
+	Camera& camera();
+	// Restricts the next renders to a region of the image, an undefined
+	//  ROI renders it whole
+	void set_crop(const OIIO::ROI& roi);
+	// Tiled formats are written with the output settings
 	void writeimage(const boost::filesystem::path& imagepath);
+	// The next renders write the image tile by tile as their last pass
+	//  completes, an empty path turns streaming off
+	void stream_to(const boost::filesystem::path& imagepath);
+	// The framebuffer normalized into the output image
+	const Image& image();
+	// Times the shading frames of the camera hits on cached geometries,
+	//  with and without the cache
+	void benchmark_frames();
 private:
-	unsigned	nthreads;
-	RTCDevice	embree_device;
-	Scene		scene;
-	Gatherer	gatherer;
-	Image		out_image;
+	CpuTopology			topology;
+	// Thread budget, shared with Embree
+	unsigned			nthreads;
+	RTCDevice			embree_device;
+	Scene				scene;
+	// What the scene was built and tessellated with
+	RenderSettings		built_settings;
+	Camera				built_camera;
+	Gatherer			gatherer;
+	Image				out_image;
+
+	Framebuffer						framebuffer;
+	AovBuffer						aov_buffer;
+	// Scanline order
+	std::vector<PixelAccumulator>	accumulation;
+	// One per thread. The stats and the queue buffers are allocated by
+	//  their pinned worker, so their pages sit on its node.
+	std::vector<unsigned>						thread_cpus;
+	std::vector<std::unique_ptr<PrimaryStats>>	primary_stats;
+	std::vector<PathQueue>						path_queues;
+	OIIO::ROI						crop;
+	boost::filesystem::path			stream_path;
+	// Of the current or last render, written with the images
+	RenderStats						stats;
+	// Last, so that the workers stop before the state they use goes away
+	ThreadPool						pool;
 
-	void render_roi(const OIIO::ROI roi, const unsigned thread_id);
+	// Pixels rendered by the next render: the crop within the image
+	OIIO::ROI render_region() const;
+	// Warns about the changed settings the scene does not pick up
+	void check_load_settings() const;
+
+	// Render tiles are handed to the writer as they complete, if any
+	void render_pass(const unsigned pixel_samples, TileWriter* writer);
+	void render_tiles
+	(
+		TileScheduler& scheduler, 
+		const unsigned pixel_samples,
+		TileWriter* writer,
+		const unsigned thread_id
+	);
+	void render_roi
+	(
+		const OIIO::ROI roi, 
+		const unsigned pixel_samples,
+		const unsigned thread_id
+	);
+	// Also records the sample count range in stats
+	size_t update_active_pixels(size_t& samples, float& mean_error);
+	// Denoises the beauty of the render region in the framebuffer
+	void denoise();
+	// Expected duration of denoise(), timed on a corner of the region
+	double estimate_denoise() const;
+	void render_roi_wavefront
+	(
+		const OIIO::ROI roi, 
+		const unsigned pixel_samples,
+		const unsigned thread_id
+	);
+	void trace_wavefront
+	(
+		PathQueue& q,
+		const size_t count,
+		const unsigned thread_id
+	);
+	void trace_primary
+	(
+		PrimaryBatch& batch,
+		RTCIntersectContext* coherent,
+		RTCIntersectContext* incoherent,
+		const unsigned thread_id
+	);
+	// aov is null when no AOV is rendered
+	void finalize_sample
+	(
+		PixelAccumulator& px,
+		const Vec3f& li,
+		const Vec2f& xy,
+		const Vec2f& pixel_uv,
+		const AovSample* aov,
+		const unsigned thread_id
+	);
+
+	SurfaceHit surface(const RTCRayHit& rh);
+	SurfaceHit surface_interpolated(const RTCRayHit& rh);
+	SurfaceHit surface_cached(const RTCRayHit& rh, const TangentFrame& frame);
+	// MIS weight of the emission found at the end of a BSDF sampled ray
+	float emission_weight
+	(
+		const RTCRayHit& rh,
+		const SurfaceHit& sh,
+		const unsigned depth,
+		const float bsdf_pdf
+	);
+	// Samples a light and returns the shadow ray to trace together with
+	//  the contribution it carries when unoccluded.
+	bool sample_direct
+	(
+		const SurfaceHit& sh,
+		const Bsdf& bsdf,
+		const unsigned depth,
+		const Sampler& sampler,
+		RTCRay& shadow,
+		Vec3f& contribution
+	);
+	Vec3f estimate_direct
+	(
+		const SurfaceHit& sh,
+		const Bsdf& bsdf,
+		const unsigned depth,
+		RTCIntersectContext* ic,
+		const Sampler& sampler
+	);
+	// Samples the BSDF and applies Russian roulette. Returns false when
+	//  the path is terminated.
+	bool continue_path
+	(
+		const SurfaceHit& sh,
+		const Bsdf& bsdf,
+		const unsigned depth,
+		const Sampler& sampler,
+		Vec3f& throughput,
+		float& bsdf_pdf,
+		RTCRay& next
+	);
+	// rh must hold the intersected camera ray. aov, if not null, receives
+	//  the first hit and the direct lighting.
 	Vec3f estimate_li
 	(
-		RTCRay r, 
+		RTCRayHit& rh, 
 		RTCIntersectContext* ic, 
-		int bounces,
-		Rand& rand,
+		const Sampler& sampler,
+		AovSample* aov,
 		const unsigned thread_id
 	);
 };
@@ -0,0 +1,163 @@
+#include "bsdf.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+Frame::Frame(const Vec3f& n) : n(n)
+{
+	// Duff et al., "Building an Orthonormal Basis, Revisited"
+	const float sign = std::copysign(1.0f, n[2]);
+	const float a = -1 / (sign + n[2]);
+	const float c = n[0] * n[1] * a;
+	t = Vec3f{1 + sign*n[0]*n[0]*a, sign*c, -sign*n[0]};
+	b = Vec3f{c, sign + n[1]*n[1]*a, -n[1]};
+}
+
+Vec3f Frame::to_local(const Vec3f& v) const
+{
+	return {dot(v, t), dot(v, b), dot(v, n)};
+}
+
+Vec3f Frame::to_world(const Vec3f& v) const
+{
+	return v[0]*t + v[1]*b + v[2]*n;
+}
+
+// Unpolarized Fresnel reflectance of a dielectric interface
+float fresnel(const float f_c, const float ior_t)
+{
+	const float ior_i = 1.0f;
+	const float ior_frac = (ior_t*ior_t) / (ior_i*ior_i);
+	const float f_g = std::sqrt(ior_frac - 1 + f_c*f_c);
+	const float g_min_c = f_g - f_c;
+	const float g_plu_c = f_g + f_c;
+	const float g_min_c2 = g_min_c*g_min_c;
+	const float g_plu_c2 = g_plu_c*g_plu_c;
+	const float f_mult1 = g_min_c2/g_plu_c2;
+	const float f_mult2_num1 = (f_c*g_plu_c - 1);
+	const float f_mult2_num = f_mult2_num1*f_mult2_num1;
+	const float f_mult2_den1 = (f_c*g_min_c + 1);
+	const float f_mult2_den = f_mult2_den1*f_mult2_den1;
+	const float f_mult2 = 1 + (f_mult2_num / f_mult2_den);
+	return 0.5f * f_mult1 * f_mult2;
+}
+
+// GGX distribution of normals
+float ggx_d(const float cos_theta_m, const float alpha_g)
+{
+	if(cos_theta_m <= 0) return 0;
+	const float alpha2_g = alpha_g*alpha_g;
+	const float cos2_theta_m = cos_theta_m*cos_theta_m;
+	const float cos4_theta_m = cos2_theta_m*cos2_theta_m;
+	const float tan2_theta_m = (1 - cos2_theta_m) / cos2_theta_m;
+	const float alpha2_tan2 = alpha2_g + tan2_theta_m;
+	return alpha2_g / (PI*cos4_theta_m*alpha2_tan2*alpha2_tan2);
+}
+
+// Smith masking term of a single direction, cosines taken to the normal
+float ggx_g1(const float v_dot_m, const float v_dot_n, const float alpha_g)
+{
+	if(v_dot_m / v_dot_n <= 0) return 0;
+	const float cos2_theta_v = v_dot_n*v_dot_n;
+	const float tan2_theta_v = (1 - cos2_theta_v) / cos2_theta_v;
+	return 2 / (1 + std::sqrt(1 + alpha_g*alpha_g*tan2_theta_v));
+}
+
+Vec3f cosine_hemisphere(const Vec2f& u)
+{
+	const float z = std::sqrt(u[0]);
+	const float r = std::sqrt(1 - z * z);
+	const float phi = 2 * PI * u[1];
+	return {r * std::cos(phi), r * std::sin(phi), z};
+}
+
+// Heitz, "Sampling the GGX Distribution of Visible Normals", JCGT 2018
+Vec3f ggx_visible_normal(const Vec3f& v, const float alpha_g, const Vec2f& u)
+{
+	const Vec3f vh = normalize(Vec3f{alpha_g*v[0], alpha_g*v[1], v[2]});
+	const float lensq = vh[0]*vh[0] + vh[1]*vh[1];
+	const Vec3f t1 = lensq > 0 ?
+		(1/std::sqrt(lensq))*Vec3f{-vh[1], vh[0], 0} :
+		Vec3f{1, 0, 0};
+	const Vec3f t2 = cross(vh, t1);
+
+	const float r = std::sqrt(u[0]);
+	const float phi = 2 * PI * u[1];
+	const float p1 = r * std::cos(phi);
+	const float s = 0.5f * (1 + vh[2]);
+	const float p2 = (1 - s)*std::sqrt(1 - p1*p1) + s*r*std::sin(phi);
+	const float p3 = std::sqrt(std::max(0.0f, 1 - p1*p1 - p2*p2));
+	const Vec3f nh = p1*t1 + p2*t2 + p3*vh;
+
+	return normalize(Vec3f{alpha_g*nh[0], alpha_g*nh[1], std::max(0.0f, nh[2])});
+}
+
+Bsdf::Bsdf(const Vec3f& n, const Vec3f& i, const Material& mat)
+	: frame(n)
+	, n(n)
+	, i(i)
+	, v_local(frame.to_local(-1*i))
+	, kd(mat.albedo)
+	, alpha(std::max(mat.roughness, 1e-3f))
+	, ior(mat.ior)
+{
+	// The specular lobe carries about F of the energy, the diffuse one
+	//  all of it. Glossy highlights are never left below 10% of the
+	//  samples, they are too peaked to be found by the diffuse lobe.
+	const float f = fresnel(std::abs(v_local[2]), ior);
+	spec_prob = std::max(0.1f, f / (1 + f));
+}
+
+Vec3f Bsdf::eval(const Vec3f& o) const
+{
+	const float o_dot_n = dot(o, n);
+	if(o_dot_n <= 0) return {};
+	const float i_dot_n = dot(i, n);
+
+	const Vec3f m = normalize(o - i);
+	const float f = fresnel(std::abs(dot(i, m)), ior);
+	const float d = ggx_d(dot(m, n), alpha);
+	const float g = 
+		ggx_g1(dot(i, m), i_dot_n, alpha) * 
+		ggx_g1(dot(o, m), o_dot_n, alpha);
+	const float spec = (f*d*g) / (4*std::abs(i_dot_n)*o_dot_n);
+
+	return (o_dot_n*(1/PI + spec))*kd;
+}
+
+float Bsdf::spec_pdf(const Vec3f& o) const
+{
+	// D_v(m) / (4 v.m), where D_v is the distribution of visible normals
+	const Vec3f m = normalize(o - i);
+	const float v_dot_n = v_local[2];
+	if(v_dot_n <= 0) return 0;
+	const float d = ggx_d(dot(m, n), alpha);
+	const float g1 = ggx_g1(-dot(i, m), v_dot_n, alpha);
+	return (g1*d) / (4*v_dot_n);
+}
+
+float Bsdf::pdf(const Vec3f& o) const
+{
+	const float o_dot_n = dot(o, n);
+	if(o_dot_n <= 0) return 0;
+	return (1 - spec_prob)*o_dot_n/PI + spec_prob*spec_pdf(o);
+}
+
+Vec3f Bsdf::sample(const Vec2f& u, float& pdf) const
+{
+	Vec3f o;
+	if(u[0] < spec_prob)
+	{
+		const Vec2f us{u[0] / spec_prob, u[1]};
+		const Vec3f m = frame.to_world(ggx_visible_normal(v_local, alpha, us));
+		// Mirror the view direction around the microfacet normal
+		o = i - (2*dot(i, m))*m;
+	}
+	else
+	{
+		const Vec2f ud{(u[0] - spec_prob) / (1 - spec_prob), u[1]};
+		o = frame.to_world(cosine_hemisphere(ud));
+	}
+	pdf = this->pdf(o);
+	return o;
+}
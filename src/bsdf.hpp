@@ -0,0 +1,55 @@
+#ifndef _BSDF_HPP_
+#define _BSDF_HPP_
+
+#include "math.hpp"
+#include "material.hpp"
+
+// Orthonormal basis around a normal
+class Frame
+{
+public:
+	Frame(const Vec3f& n);
+	Vec3f to_local(const Vec3f& v) const;
+	Vec3f to_world(const Vec3f& v) const;
+
+private:
+	Vec3f t;
+	Vec3f b;
+	Vec3f n;
+};
+
+/*
+ * Lambertian diffuse plus a GGX microfacet lobe with dielectric Fresnel,
+ *  both tinted by the albedo.
+ * i is the direction of the incoming ray, n must face the side it comes
+ *  from. Outgoing directions o point away from the surface.
+ */
+class Bsdf
+{
+public:
+	Bsdf(const Vec3f& n, const Vec3f& i, const Material& mat);
+
+	// BSDF times the cosine term
+	Vec3f eval(const Vec3f& o) const;
+	// Solid angle density of sample()
+	float pdf(const Vec3f& o) const;
+	// Picks a lobe with u[0], then samples the cosine weighted
+	//  hemisphere or the GGX distribution of visible normals.
+	Vec3f sample(const Vec2f& u, float& pdf) const;
+
+private:
+	Frame frame;
+	Vec3f n;
+	Vec3f i;
+	// View direction in the local frame
+	Vec3f v_local;
+	Vec3f kd;
+	float alpha;
+	float ior;
+	// Probability of sampling the specular lobe
+	float spec_prob;
+
+	float spec_pdf(const Vec3f& o) const;
+};
+
+#endif
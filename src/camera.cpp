@@ -38,17 +38,59 @@ RTCRay Camera::generate_ray(const Vec2f ij)
 	r.org_y = eye[1];
 	r.org_z = eye[2];
 
-	const Vec3f on_film
-	{
-		(2*ij[0] - 1)*.5f*(aspect*gate),
-		(2*ij[1] - 1)*.5f*(gate),
-		-focal*MM_TO_CM
-	};
-	const Vec3f in_world = normalize(transformVector(mat, on_film));
+	const Vec3f in_world = direction(ij);
 
 	r.dir_x = in_world[0];
 	r.dir_y = in_world[1];
 	r.dir_z = in_world[2];
 
 	return r;
+}
+
+void Camera::generate_ray8(
+	const Vec2f* ij, 
+	const unsigned count, 
+	RTCRay8& rays
+) {
+	const Vec3f eye = transformPoint(mat, {});
+	for(unsigned l = 0; l < count; ++l)
+	{
+		const Vec3f in_world = direction(ij[l]);
+
+		rays.tnear[l] = 0;
+		rays.tfar[l]  = INFINITY;
+		rays.time[l]  = 0;
+		rays.mask[l]  = 0;
+		rays.id[l]    = l;
+		rays.flags[l] = 0;
+
+		rays.org_x[l] = eye[0];
+		rays.org_y[l] = eye[1];
+		rays.org_z[l] = eye[2];
+
+		rays.dir_x[l] = in_world[0];
+		rays.dir_y[l] = in_world[1];
+		rays.dir_z[l] = in_world[2];
+	}
+}
+
+Vec3f Camera::position() const
+{
+	return transformPoint(mat, {});
+}
+
+float Camera::pixel_footprint(const unsigned image_height) const
+{
+	return gate / (focal*MM_TO_CM) / image_height;
+}
+
+Vec3f Camera::direction(const Vec2f ij)
+{
+	const Vec3f on_film
+	{
+		(2*ij[0] - 1)*.5f*(aspect*gate),
+		(2*ij[1] - 1)*.5f*(gate),
+		-focal*MM_TO_CM
+	};
+	return normalize(transformVector(mat, on_film));
 }
\ No newline at end of file
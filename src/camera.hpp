@@ -20,12 +20,20 @@ public:
 
 	// Ray from film coords
 	RTCRay generate_ray (const Vec2f ij);
+	// SoA packet of rays from film coords, lanes past count are untouched
+	void generate_ray8 (const Vec2f* ij, const unsigned count, RTCRay8& rays);
+
+	Vec3f position() const;
+	// Height of a pixel seen at unit distance from the eye
+	float pixel_footprint(const unsigned image_height) const;
 
 private:
  	float gate;
 	float focal;
 	float aspect;
 	Mat4f mat;
+
+	Vec3f direction (const Vec2f ij);
 };
 
 #endif
\ No newline at end of file
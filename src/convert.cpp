@@ -0,0 +1,53 @@
+#include "manifest.hpp"
+
+#include <iostream>
+
+/*
+ * Converts a JSON scene file into a binary manifest. The buffers file is
+ *  left in place and referenced from the manifest.
+ *
+ * bouncer-convert scene.json [scene.bnc]
+ */
+int main(int argc, char* argv[])
+{
+	if(argc < 2 || argc > 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " scene.json [manifest.bnc]\n";
+		return 1;
+	}
+
+	const boost::filesystem::path json_path = argv[1];
+	boost::filesystem::path manifest_path = json_path;
+	if(argc == 3)
+		manifest_path = argv[2];
+	else
+		manifest_path.replace_extension(".bnc");
+
+	try
+	{
+		Manifest manifest;
+		manifest.load_json(json_path);
+
+		// The manifest may live in another directory than the scene file
+		const boost::filesystem::path buffers_path = 
+			boost::filesystem::absolute(json_path.parent_path()) /
+			manifest.buffers_path;
+		manifest.buffers_path = boost::filesystem::relative
+		(
+			buffers_path,
+			boost::filesystem::absolute(manifest_path).parent_path()
+		);
+
+		manifest.write(manifest_path);
+		BOOST_LOG_TRIVIAL(info) << 
+			"Wrote " << manifest.ngeometries << " geometries to \"" <<
+			manifest_path.string() << "\"";
+	}
+	catch(const std::exception& e)
+	{
+		// Parse and type errors of the JSON scene are not logged on the way
+		BOOST_LOG_TRIVIAL(fatal) << e.what();
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include "denoiser.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Below this the albedo is too dark to divide by
+static const float min_albedo = 1e-3f;
+
+float distance2(const float* a, const float* b)
+{
+	const float d0 = a[0] - b[0];
+	const float d1 = a[1] - b[1];
+	const float d2 = a[2] - b[2];
+	return d0*d0 + d1*d1 + d2*d2;
+}
+
+Denoiser::Denoiser
+(
+	const DenoiseSettings&		s,
+	const OIIO::ROI&			r,
+	std::vector<float>&&		color,
+	std::vector<float>&&		a,
+	std::vector<float>&&		n
+)
+	: settings(s)
+	, region(r)
+	, width(r.xend - r.xbegin)
+	, height(r.yend - r.ybegin)
+	, albedo(std::move(a))
+	, normal(std::move(n))
+	, current(std::move(color))
+	, next(current.size())
+{
+	for(size_t i = 0; i < current.size(); ++i)
+	{
+		if(albedo[i] > min_albedo) current[i] /= albedo[i];
+	}
+}
+
+void Denoiser::filter(const OIIO::ROI& roi, const unsigned iteration)
+{
+	static const float kernel[5] = {1/16.0f, 1/4.0f, 3/8.0f, 1/4.0f, 1/16.0f};
+	const int step = 1 << iteration;
+	const float sigma_color = settings.sigma_color / (1 << iteration);
+	const float inv_normal = 1 /
+		std::max(settings.sigma_normal*settings.sigma_normal, 1e-8f);
+	const float inv_albedo = 1 /
+		std::max(settings.sigma_albedo*settings.sigma_albedo, 1e-8f);
+
+	const int y0 = std::max(roi.ybegin, region.ybegin) - region.ybegin;
+	const int y1 = std::min(roi.yend, region.yend) - region.ybegin;
+	const int x0 = std::max(roi.xbegin, region.xbegin) - region.xbegin;
+	const int x1 = std::min(roi.xend, region.xend) - region.xbegin;
+	for(int y = y0; y < y1; ++y)
+	for(int x = x0; x < x1; ++x)
+	{
+		const size_t p = (size_t(y)*width + x)*3;
+		// Illumination differences are relative to the pixel, HDR values
+		//  span too many orders of magnitude for an absolute threshold
+		const float brightness = 
+			(current[p] + current[p + 1] + current[p + 2]) / 3;
+		const float inv_color = 1 / std::max
+		(
+			sigma_color*sigma_color*(brightness*brightness + 1e-4f), 1e-12f
+		);
+		float sum[3] = {0, 0, 0};
+		float wsum = 0;
+		for(int j = 0; j < 5; ++j)
+		{
+			const int qy = y + (j - 2)*step;
+			if(qy < 0 || qy >= (int)height) continue;
+			for(int i = 0; i < 5; ++i)
+			{
+				const int qx = x + (i - 2)*step;
+				if(qx < 0 || qx >= (int)width) continue;
+				const size_t q = (size_t(qy)*width + qx)*3;
+
+				const float w = kernel[i]*kernel[j]*std::exp
+				(
+					-distance2(&current[p], &current[q])*inv_color
+					-distance2(&normal[p], &normal[q])*inv_normal
+					-distance2(&albedo[p], &albedo[q])*inv_albedo
+				);
+				sum[0] += w*current[q];
+				sum[1] += w*current[q + 1];
+				sum[2] += w*current[q + 2];
+				wsum += w;
+			}
+		}
+		// The center tap always has a positive weight
+		for(int k = 0; k < 3; ++k) next[p + k] = sum[k] / wsum;
+	}
+}
+
+void Denoiser::swap()
+{
+	current.swap(next);
+}
+
+std::vector<float> Denoiser::result() const
+{
+	std::vector<float> rgb(current);
+	for(size_t i = 0; i < rgb.size(); ++i)
+	{
+		if(albedo[i] > min_albedo) rgb[i] *= albedo[i];
+	}
+	return rgb;
+}
@@ -0,0 +1,62 @@
+#ifndef _DENOISER_HPP_
+#define _DENOISER_HPP_
+
+#include <OpenImageIO/imagebuf.h>
+
+#include <vector>
+
+class DenoiseSettings
+{
+public:
+	bool		enabled;
+	// The filter footprint doubles with every iteration
+	unsigned	iterations;
+	// Edge stopping on the illumination, relative to its brightness and
+	//  halved at every iteration
+	float		sigma_color;
+	float		sigma_normal;
+	float		sigma_albedo;
+};
+
+/*
+ * Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010). Every
+ *  iteration applies a 5x5 B3 spline kernel with taps spaced 2^i pixels
+ *  apart, weighted down across edges of the illumination, the normals
+ *  and the albedo. The beauty is divided by the albedo beforehand so that
+ *  textures are not blurred, and multiplied back at the end.
+ * Iterations read one buffer and write the other, so the pixels of an
+ *  iteration can be filtered in any order and on any thread.
+ */
+class Denoiser
+{
+public:
+	// RGB images of the region, interleaved, scanline order
+	Denoiser
+	(
+		const DenoiseSettings&		settings,
+		const OIIO::ROI&			region,
+		std::vector<float>&&		color,
+		std::vector<float>&&		albedo,
+		std::vector<float>&&		normal
+	);
+
+	// Filters the pixels of roi, within the region
+	void filter(const OIIO::ROI& roi, const unsigned iteration);
+	// Called between iterations
+	void swap();
+	// Denoised beauty, after the last swap
+	std::vector<float> result() const;
+
+private:
+	DenoiseSettings		settings;
+	OIIO::ROI			region;
+	unsigned			width;
+	unsigned			height;
+	std::vector<float>	albedo;
+	std::vector<float>	normal;
+	// Illumination read and written by the current iteration
+	std::vector<float>	current;
+	std::vector<float>	next;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "device.hpp"
+
+#include <xmmintrin.h>
+#include <pmmintrin.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+unsigned affinity_cpus()
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+	return CPU_COUNT(&set);
+}
+
+// Cgroup v2 cpu.max holds "<quota> <period>" or "max <period>"
+unsigned cgroup2_cpus(const std::string& cpu_max_path)
+{
+	std::ifstream cpu_max{cpu_max_path};
+	std::string quota;
+	double period;
+	if(!(cpu_max >> quota >> period) || quota == "max" || period <= 0)
+		return 0;
+	return std::max(1.0, std::ceil(std::stod(quota) / period));
+}
+
+// Cgroup v1 splits it in two files, a negative quota meaning no limit
+unsigned cgroup1_cpus(const std::string& cpu_dir)
+{
+	std::ifstream quota_file{cpu_dir + "/cpu.cfs_quota_us"};
+	std::ifstream period_file{cpu_dir + "/cpu.cfs_period_us"};
+	double quota, period;
+	if(!(quota_file >> quota) || !(period_file >> period))
+		return 0;
+	if(quota <= 0 || period <= 0) return 0;
+	return std::max(1.0, std::ceil(quota / period));
+}
+
+/*
+ * CPU quota of the cgroup of this process, 0 when unlimited. Limits of
+ *  the parent cgroups apply too, so the whole v2 hierarchy is walked.
+ */
+unsigned cgroup_cpus()
+{
+	std::ifstream cgroup_file{"/proc/self/cgroup"};
+	std::string line;
+	while(std::getline(cgroup_file, line))
+	{
+		// "0::<path>" for v2
+		if(line.compare(0, 3, "0::") != 0) continue;
+
+		std::string path = line.substr(3);
+		unsigned cpus = 0;
+		for(;;)
+		{
+			const unsigned c = 
+				cgroup2_cpus("/sys/fs/cgroup" + path + "/cpu.max");
+			if(c > 0) cpus = cpus > 0 ? std::min(cpus, c) : c;
+			if(path.empty() || path == "/") break;
+			path = path.substr(0, path.rfind('/'));
+		}
+		if(cpus > 0) return cpus;
+		// Hybrid hierarchies may keep the cpu controller on v1
+		break;
+	}
+	// Containers mount their own v1 cgroup at the root of the hierarchy
+	for(const char* dir : {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"})
+	{
+		const unsigned cpus = cgroup1_cpus(dir);
+		if(cpus > 0) return cpus;
+	}
+	return 0;
+}
+
+unsigned thread_budget()
+{
+	unsigned budget = affinity_cpus();
+	if(budget == 0) budget = std::thread::hardware_concurrency();
+
+	const unsigned quota = cgroup_cpus();
+	if(quota > 0 && quota < budget)
+	{
+		BOOST_LOG_TRIVIAL(info) << 
+			"Limited to " << quota << " threads by the cgroup CPU quota";
+		budget = quota;
+	}
+	return std::max(1u, budget);
+}
+
+RTCDevice initialize_embree_device
+(
+	const DeviceSettings& settings, 
+	const unsigned nthreads
+) {
+	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+
+	std::ostringstream config;
+	config << "threads=" << nthreads;
+	config << ",set_affinity=" << (settings.set_affinity ? 1 : 0);
+	config << ",verbose=" << settings.verbose;
+	if(!settings.isa.empty()) config << ",isa=" << settings.isa;
+	if(settings.tessellation_cache > 0)
+	{
+		config << ",tessellation_cache_size=" << 
+			size_t(settings.tessellation_cache) * 1024 * 1024;
+	}
+
+	BOOST_LOG_TRIVIAL(info) << "Embree device \"" << config.str() << "\"";
+	RTCDevice device = rtcNewDevice(config.str().c_str());
+	if(!device)
+	{
+		BOOST_LOG_TRIVIAL(fatal) << 
+			"Could not create the Embree device (error " << 
+			rtcGetDeviceError(nullptr) << ")";
+		throw std::runtime_error("Could not create Embree device");
+	}
+	return device;
+}
@@ -0,0 +1,43 @@
+#ifndef _DEVICE_HPP_
+#define _DEVICE_HPP_
+
+#include "topology.hpp"
+
+#include <embree3/rtcore.h>
+
+#include <boost/log/trivial.hpp>
+
+#include <string>
+
+// Embree device configuration, see the rtcNewDevice documentation
+class DeviceSettings
+{
+public:
+	// Threads shared by rendering, loading and Embree's builders,
+	//  0 uses the thread budget of the process
+	unsigned	threads			= 0;
+	// Pin Embree's build threads to cores
+	bool		set_affinity	= false;
+	// Empty lets Embree pick the best ISA the CPU supports
+	std::string	isa;
+	unsigned	verbose			= 3;
+	// Cache of tessellated subdivision patches in MB, 0 keeps Embree's
+	unsigned	tessellation_cache	= 0;
+	// Render threads only, Embree's are pinned through set_affinity
+	PinPolicy	pin				= PinPolicy::none;
+};
+
+/*
+ * Cores this process may actually use: the smallest of the CPUs in its
+ *  affinity mask and of its cgroup CPU quota, rounded up. In containers
+ *  hardware_concurrency reports the cores of the host instead.
+ */
+unsigned thread_budget();
+
+RTCDevice initialize_embree_device
+(
+	const DeviceSettings& settings, 
+	const unsigned nthreads
+);
+
+#endif
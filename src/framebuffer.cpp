@@ -0,0 +1,184 @@
+#include "framebuffer.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+FilterType parse_filter(const std::string& name)
+{
+	if(name == "tent") return FilterType::tent;
+	if(name == "gaussian") return FilterType::gaussian;
+	if(name == "blackman-harris") return FilterType::blackman_harris;
+	if(name != "box")
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Unknown filter \"" << name << "\", using box";
+	}
+	return FilterType::box;
+}
+
+Filter::Filter(const FilterType t, const float r)
+	: type(t)
+	, radius(r)
+{
+	if(radius > 0) return;
+	switch(type)
+	{
+		case FilterType::box:				radius = 0.5f; break;
+		case FilterType::tent:				radius = 1.0f; break;
+		case FilterType::gaussian:			radius = 1.5f; break;
+		case FilterType::blackman_harris:	radius = 2.0f; break;
+	}
+}
+
+float Filter::eval(const float d) const
+{
+	switch(type)
+	{
+		// Half-open so that a sample lands in exactly one pixel
+		case FilterType::box:
+			return d >= -radius && d < radius ? 1 : 0;
+		case FilterType::tent:
+			return std::max(0.0f, 1 - std::abs(d) / radius);
+		case FilterType::gaussian:
+		{
+			// Shifted down to reach 0 at the radius
+			const float alpha = 2;
+			return std::max
+			(
+				0.0f, 
+				std::exp(-alpha*d*d) - std::exp(-alpha*radius*radius)
+			);
+		}
+		case FilterType::blackman_harris:
+		{
+			if(std::abs(d) >= radius) return 0;
+			const float t = 2*float(M_PI)*(0.5f + 0.5f*d / radius);
+			return 
+				0.35875f - 0.48829f*std::cos(t) + 
+				0.14128f*std::cos(2*t) - 0.01168f*std::cos(3*t);
+		}
+	}
+	return 0;
+}
+
+void atomic_add(std::atomic<float>& a, const float v)
+{
+	float old = a.load(std::memory_order_relaxed);
+	while(!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed));
+}
+
+Framebuffer::Framebuffer()
+	: width(0)
+	, height(0)
+	, tiles_x(0)
+	, ntiles(0)
+{}
+
+void Framebuffer::resize(const unsigned w, const unsigned h)
+{
+	const unsigned ts = FramebufferTile::size;
+	width = w;
+	height = h;
+	tiles_x = (w + ts - 1) / ts;
+	ntiles = size_t(tiles_x) * ((h + ts - 1) / ts);
+	tiles.reset(new FramebufferTile[ntiles]);
+	clear();
+}
+
+void Framebuffer::clear()
+{
+	for(size_t t = 0; t < ntiles; ++t)
+	for(auto& p : tiles[t].pixels)
+	for(std::atomic<float>& c : p)
+		c.store(0, std::memory_order_relaxed);
+}
+
+void Framebuffer::set_filter(const Filter& f)
+{
+	filter = f;
+}
+
+unsigned Framebuffer::reach() const
+{
+	// Samples lie anywhere in their pixel, the support spans the centers
+	//  within the radius
+	return (unsigned)std::max(0.0f, std::ceil(filter.radius - 0.5f));
+}
+
+std::atomic<float>* Framebuffer::pixel(const unsigned x, const unsigned y) const
+{
+	const unsigned ts = FramebufferTile::size;
+	FramebufferTile& tile = tiles[(y / ts)*tiles_x + x / ts];
+	return tile.pixels[(y % ts)*ts + x % ts];
+}
+
+void Framebuffer::splat(const Vec2f p, const Vec3f& c)
+{
+	// Pixels whose center is within the support
+	const float r = filter.radius;
+	const int x0 = std::max(0, (int)std::ceil(p[0] - r - 0.5f));
+	const int x1 = std::min((int)width - 1, (int)std::floor(p[0] + r - 0.5f));
+	const int y0 = std::max(0, (int)std::ceil(p[1] - r - 0.5f));
+	const int y1 = std::min((int)height - 1, (int)std::floor(p[1] + r - 0.5f));
+
+	for(int y = y0; y <= y1; ++y)
+	{
+		const float wy = filter.eval(p[1] - (y + 0.5f));
+		if(wy == 0) continue;
+		for(int x = x0; x <= x1; ++x)
+		{
+			const float w = wy*filter.eval(p[0] - (x + 0.5f));
+			if(w == 0) continue;
+			std::atomic<float>* px = pixel(x, y);
+			atomic_add(px[0], w*c[0]);
+			atomic_add(px[1], w*c[1]);
+			atomic_add(px[2], w*c[2]);
+			atomic_add(px[3], w);
+		}
+	}
+}
+
+void Framebuffer::resolve(OIIO::ImageBuf& image) const
+{
+	std::vector<float> rgb(size_t(width)*height*3);
+	resolve(OIIO::ROI(0, width, 0, height), rgb.data(), 3, size_t(width)*3);
+	const OIIO::ROI roi
+	(
+		image.xbegin(), image.xbegin() + width,
+		image.ybegin(), image.ybegin() + height,
+		0, 1, 0, 3
+	);
+	image.set_pixels(roi, OIIO::TypeDesc::FLOAT, rgb.data());
+}
+
+void Framebuffer::load(const OIIO::ROI& roi, const float* rgb)
+{
+	for(int y = roi.ybegin; y < roi.yend; ++y)
+	for(int x = roi.xbegin; x < roi.xend; ++x)
+	{
+		std::atomic<float>* px = pixel(x, y);
+		for(int k = 0; k < 3; ++k) px[k].store(*rgb++, std::memory_order_relaxed);
+		px[3].store(1, std::memory_order_relaxed);
+	}
+}
+
+void Framebuffer::resolve
+(
+	const OIIO::ROI& roi,
+	float* rgb,
+	const size_t stride,
+	const size_t row_stride
+) const {
+	for(int y = roi.ybegin; y < roi.yend; ++y)
+	for(int x = roi.xbegin; x < roi.xend; ++x)
+	{
+		const std::atomic<float>* px = pixel(x, y);
+		const float w = px[3].load(std::memory_order_relaxed);
+		float* out = &rgb[(y - roi.ybegin)*row_stride + (x - roi.xbegin)*stride];
+		for(int k = 0; k < 3; ++k)
+			out[k] = w > 0 ? px[k].load(std::memory_order_relaxed) / w : 0;
+	}
+}
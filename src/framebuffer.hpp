@@ -0,0 +1,87 @@
+#ifndef _FRAMEBUFFER_HPP_
+#define _FRAMEBUFFER_HPP_
+
+#include "math.hpp"
+
+#include <OpenImageIO/imagebuf.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+enum class FilterType
+{
+	box,
+	tent,
+	gaussian,
+	blackman_harris
+};
+
+FilterType parse_filter(const std::string& name);
+
+// Separable pixel reconstruction filter
+class Filter
+{
+public:
+	FilterType	type;
+	// Support in pixels, 0 picks the usual one for the type
+	float		radius;
+
+	Filter(const FilterType type = FilterType::box, const float radius = 0);
+	// Weight of a sample at offset d from the pixel center along one axis
+	float eval(const float d) const;
+};
+
+// Square tile of the framebuffer, whole cache lines
+class alignas(64) FramebufferTile
+{
+public:
+	static const unsigned size = 4;
+	// Weighted RGB and the sum of the weights
+	std::atomic<float> pixels[size*size][4];
+};
+
+/*
+ * Accumulates filtered samples. A sample is splatted on every pixel in the
+ *  support of the filter, possibly in tiles rendered by other threads, 
+ *  with lock-free atomic adds. Pixels are normalized only when resolved 
+ *  into an image.
+ */
+class Framebuffer
+{
+public:
+	Framebuffer();
+
+	void resize(const unsigned width, const unsigned height);
+	void clear();
+	void set_filter(const Filter& filter);
+	// Pixels beyond its own that a sample may be splatted on
+	unsigned reach() const;
+
+	// p in pixels from the top-left corner of the framebuffer
+	void splat(const Vec2f p, const Vec3f& c);
+	void resolve(OIIO::ImageBuf& image) const;
+	// Replaces a region by normalized RGB, as a post process does
+	void load(const OIIO::ROI& roi, const float* rgb);
+	// Normalized RGB of a region of the framebuffer, pixels are stride
+	//  floats apart and rows row_stride floats apart
+	void resolve
+	(
+		const OIIO::ROI& roi,
+		float* rgb,
+		const size_t stride,
+		const size_t row_stride
+	) const;
+
+private:
+	unsigned							width;
+	unsigned							height;
+	unsigned							tiles_x;
+	size_t								ntiles;
+	std::unique_ptr<FramebufferTile[]>	tiles;
+	Filter								filter;
+
+	std::atomic<float>* pixel(const unsigned x, const unsigned y) const;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "lights.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void AliasTable::build(const std::vector<float>& weights)
+{
+	const size_t n = weights.size();
+	threshold.assign(n, 1);
+	alias.resize(n);
+	probability.assign(n, 0);
+
+	double total = 0;
+	for(const float w : weights) total += w;
+	if(total <= 0)
+	{
+		threshold.clear();
+		alias.clear();
+		probability.clear();
+		return;
+	}
+
+	std::vector<float> scaled(n);
+	std::vector<unsigned> small, large;
+	for(size_t i = 0; i < n; ++i)
+	{
+		probability[i] = weights[i] / total;
+		scaled[i] = probability[i] * n;
+		alias[i] = i;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+
+	while(!small.empty() && !large.empty())
+	{
+		const unsigned s = small.back(); small.pop_back();
+		const unsigned l = large.back(); large.pop_back();
+		threshold[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] = (scaled[l] + scaled[s]) - 1;
+		(scaled[l] < 1 ? small : large).push_back(l);
+	}
+	// Whatever is left is 1 up to rounding errors
+}
+
+unsigned AliasTable::sample(const float u) const
+{
+	const size_t n = threshold.size();
+	const float x = u * n;
+	const unsigned i = std::min((size_t)x, n - 1);
+	return (x - i) < threshold[i] ? i : alias[i];
+}
+
+float AliasTable::pmf(const unsigned i) const
+{
+	return probability[i];
+}
+
+bool AliasTable::empty() const
+{
+	return threshold.empty();
+}
+
+Vec3f buffer_vertex(const float* vertices, const unsigned idx)
+{
+	return {vertices[3*idx], vertices[3*idx + 1], vertices[3*idx + 2]};
+}
+
+float cross_length(const Vec3f& a, const Vec3f& b)
+{
+	const Vec3f c = cross(a, b);
+	return std::sqrt(dot(c, c));
+}
+
+void Lights::add_geometry
+(
+	const unsigned			geomID,
+	const RTCGeometry		geom,
+	const bool				triangles,
+	const GeometryBuffers&	buffers,
+	const Vec3f&			emittance
+) {
+	if(geom_emitter.size() <= geomID) geom_emitter.resize(geomID + 1, -1);
+	geom_emitter[geomID] = emitters.size();
+
+	const unsigned first = primitives.size();
+	const unsigned emitter = emitters.size();
+	emitters.push_back({geom, triangles, emittance, first});
+
+	const float radiance = (emittance[0] + emittance[1] + emittance[2]) / 3;
+	const float* vertices = buffers.vertices;
+	const uint32_t* indices = buffers.indices;
+
+	auto add_primitive = [&](const float area)
+	{
+		const unsigned primID = primitives.size() - first;
+		primitives.push_back({emitter, primID});
+		power.push_back(area * radiance);
+	};
+
+	if(triangles)
+	{
+		for(size_t t = 0; t < buffers.nprimitives; ++t)
+		{
+			const Vec3f p0 = buffer_vertex(vertices, indices[3*t]);
+			const Vec3f p1 = buffer_vertex(vertices, indices[3*t + 1]);
+			const Vec3f p2 = buffer_vertex(vertices, indices[3*t + 2]);
+			add_primitive(0.5f*cross_length(p1 - p0, p2 - p0));
+		}
+	}
+	else
+	{
+		// Areas come from the control cage, good enough as weights
+		const uint32_t* faces = buffers.faces;
+		size_t idx = 0;
+		for(size_t f = 0; f < buffers.nprimitives; ++f)
+		{
+			float area = 0;
+			if(faces[f] == 4)
+			{
+				const Vec3f p0 = buffer_vertex(vertices, indices[idx]);
+				const Vec3f p1 = buffer_vertex(vertices, indices[idx + 1]);
+				const Vec3f p2 = buffer_vertex(vertices, indices[idx + 2]);
+				const Vec3f p3 = buffer_vertex(vertices, indices[idx + 3]);
+				area = 0.5f*cross_length(p2 - p0, p3 - p1);
+			}
+			add_primitive(area);
+			idx += faces[f];
+		}
+	}
+}
+
+void Lights::build()
+{
+	table.build(power);
+	power.clear();
+	power.shrink_to_fit();
+}
+
+bool Lights::empty() const
+{
+	return table.empty();
+}
+
+LightSample Lights::sample(const float u_light, const Vec2f& uv) const
+{
+	const unsigned i = table.sample(u_light);
+	const Primitive& prim = primitives[i];
+	const Emitter& emitter = emitters[prim.emitter];
+
+	// Triangles are sampled uniformly through their barycentrics,
+	//  quads through their (u,v) parametrization.
+	float u = uv[0], v = uv[1], uv_pdf = 1;
+	if(emitter.triangles)
+	{
+		const float su = std::sqrt(uv[0]);
+		u = 1 - su;
+		v = uv[1] * su;
+		uv_pdf = 2;
+	}
+
+	Vec3f p, dpdu, dpdv;
+	RTCInterpolateArguments ia;
+	ia.geometry		= emitter.geom;
+	ia.primID		= prim.primID;
+	ia.u			= u;
+	ia.v			= v;
+	ia.bufferType	= RTC_BUFFER_TYPE_VERTEX;
+	ia.bufferSlot	= 0;
+	ia.P			= (float*)(&p);
+	ia.dPdu			= (float*)(&dpdu);
+	ia.dPdv			= (float*)(&dpdv);
+	ia.ddPdudu		= nullptr;
+	ia.valueCount	= 3;
+	rtcInterpolate(&ia);
+
+	const float jacobian = cross_length(dpdu, dpdv);
+	return
+	{
+		p,
+		normalize(cross(dpdu, dpdv)),
+		emitter.emittance,
+		jacobian > 0 ? table.pmf(i) * uv_pdf / jacobian : 0
+	};
+}
+
+float Lights::pdf
+(
+	const unsigned	geomID,
+	const unsigned	primID,
+	const Vec3f&	dpdu,
+	const Vec3f&	dpdv
+) const {
+	if(table.empty() || geomID >= geom_emitter.size()) return 0;
+	const int e = geom_emitter[geomID];
+	if(e < 0) return 0;
+
+	const Emitter& emitter = emitters[e];
+	const float uv_pdf = emitter.triangles ? 2 : 1;
+	const float jacobian = cross_length(dpdu, dpdv);
+	if(jacobian <= 0) return 0;
+	return table.pmf(emitter.first + primID) * uv_pdf / jacobian;
+}
@@ -0,0 +1,101 @@
+#ifndef _LIGHTS_HPP_
+#define _LIGHTS_HPP_
+
+#include "math.hpp"
+
+#include <embree3/rtcore.h>
+#include <cstdint>
+#include <vector>
+
+// Raw buffers of a geometry as loaded from the scene file
+class GeometryBuffers
+{
+public:
+	const float*	vertices	= nullptr;
+	const uint32_t*	indices		= nullptr;
+	// Vertex count of every face, subdivision surfaces only
+	const uint32_t*	faces		= nullptr;
+	// Triangles for meshes, faces for subdivision surfaces
+	size_t			nprimitives	= 0;
+};
+
+// Walker's alias method: constant time sampling of a discrete distribution
+class AliasTable
+{
+public:
+	void build(const std::vector<float>& weights);
+	unsigned sample(const float u) const;
+	float pmf(const unsigned i) const;
+	bool empty() const;
+
+private:
+	std::vector<float>		threshold;
+	std::vector<unsigned>	alias;
+	std::vector<float>		probability;
+};
+
+class LightSample
+{
+public:
+	Vec3f p;
+	Vec3f n;
+	Vec3f emittance;
+	// Density with respect to area
+	float pdf;
+};
+
+/*
+ * Emissive primitives of the scene, sampled proportionally to their power.
+ * Subdivision faces are sampled on their limit surface through
+ *  rtcInterpolate. Only quads are supported, other faces get no samples.
+ */
+class Lights
+{
+public:
+	void add_geometry
+	(
+		const unsigned			geomID,
+		const RTCGeometry		geom,
+		const bool				triangles,
+		const GeometryBuffers&	buffers,
+		const Vec3f&			emittance
+	);
+	void build();
+	bool empty() const;
+
+	LightSample sample(const float u_light, const Vec2f& uv) const;
+	// Area density with which sample() picks the given surface point
+	float pdf
+	(
+		const unsigned	geomID,
+		const unsigned	primID,
+		const Vec3f&	dpdu,
+		const Vec3f&	dpdv
+	) const;
+
+private:
+	class Emitter
+	{
+	public:
+		RTCGeometry	geom;
+		bool		triangles;
+		Vec3f		emittance;
+		// Index of the first primitive in the table
+		unsigned	first;
+	};
+
+	class Primitive
+	{
+	public:
+		unsigned	emitter;
+		unsigned	primID;
+	};
+
+	std::vector<Emitter>	emitters;
+	std::vector<int>		geom_emitter;
+	std::vector<Primitive>	primitives;
+	std::vector<float>		power;
+	AliasTable				table;
+};
+
+#endif
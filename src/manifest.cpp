@@ -0,0 +1,307 @@
+#include "manifest.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+bool parse_buffer_type(const std::string& name, uint32_t& type)
+{
+	if(name == "indices")		type = buffer_indices;
+	else if(name == "vertices")	type = buffer_vertices;
+	else if(name == "faces")	type = buffer_faces;
+	else if(name == "creaseindices")	type = buffer_creaseindices;
+	else if(name == "creasevalues")		type = buffer_creasevalues;
+	else return false;
+	return true;
+}
+
+ManifestMaterial parse_material(const nlohmann::json& json_material)
+{
+	const nlohmann::json& json_albedo{json_material["albedo"]};
+	const nlohmann::json& json_emittance{json_material["emittance"]};
+	return {
+		{json_albedo[0], json_albedo[1], json_albedo[2]},
+		{json_emittance[0], json_emittance[1], json_emittance[2]},
+		json_material.value("roughness", 1.0f),
+		json_material.value("ior", 1.2f)
+	};
+}
+
+template<typename T>
+const T* table(const MappedFile& file, const uint64_t offset, const size_t count)
+{
+	if(offset % alignof(T) != 0 || offset + count*sizeof(T) > file.size())
+	{
+		BOOST_LOG_TRIVIAL(fatal) << "Manifest table out of bounds";
+		throw std::runtime_error("Corrupted scene manifest");
+	}
+	return (const T*)(file.data() + offset);
+}
+
+size_t align8(const size_t offset)
+{
+	return (offset + 7) & ~size_t(7);
+}
+
+Manifest::Manifest()
+	: geometries(nullptr)
+	, ngeometries(0)
+	, materials(nullptr)
+	, nmaterials(0)
+	, buffers(nullptr)
+	, nbuffers(0)
+	, instances(nullptr)
+	, ninstances(0)
+{}
+
+bool Manifest::is_manifest(const boost::filesystem::path& path)
+{
+	char magic[sizeof(manifest_magic)] = {};
+	std::ifstream file{path.string(), std::ios::binary};
+	file.read(magic, sizeof(magic));
+	return file && std::memcmp(magic, manifest_magic, sizeof(magic)) == 0;
+}
+
+void Manifest::open(const boost::filesystem::path& path)
+{
+	if(is_manifest(path))
+		load(path);
+	else
+		load_json(path);
+}
+
+void Manifest::load_json(const boost::filesystem::path& json_path)
+{
+	nlohmann::json json_data;
+	std::ifstream json_file{json_path.string()};
+	if(!json_file)
+	{
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"Could not open \"" << json_path.string() << "\"";
+		throw std::runtime_error("Could not open scene file");
+	}
+	json_file >> json_data;
+	json_file.close();
+
+	settings = nlohmann::json::object();
+	for(const char* key : {"render", "camera", "load"})
+	{
+		if(json_data.contains(key)) settings[key] = json_data[key];
+	}
+	buffers_path = json_path.filename();
+	buffers_path.replace_extension(".bin");
+
+	const nlohmann::json& json_geoms = json_data["geometries"];
+	geometries_storage.clear();
+	materials_storage.clear();
+	buffers_storage.clear();
+	instances_storage.clear();
+	geometries_storage.reserve(json_geoms.size());
+	materials_storage.reserve(json_geoms.size());
+
+	// Files without offsets store their buffers back to back
+	uint64_t next_offset = 0;
+	for(const nlohmann::json& json_geom : json_geoms)
+	{
+		const bool triangles = json_geom["triangles"];
+		ManifestGeometry geom;
+		geom.flags =
+			(triangles ? (uint32_t)geometry_triangles : 0u) |
+			(json_geom.value("smooth", false) ? (uint32_t)geometry_smooth : 0u) |
+			(json_geom.value("shading_frames", "cached") == "interpolated" ? 
+				(uint32_t)geometry_interpolated_frames : 0u);
+		geom.material = materials_storage.size();
+		geom.first_buffer = buffers_storage.size();
+		geom.prototype = json_geom.value("prototype", manifest_no_prototype);
+		geom.tessellation_rate = json_geom.value("tessellation_rate", 0.0f);
+
+		materials_storage.push_back(parse_material(json_geom["material"]));
+
+		for(const nlohmann::json& json_buf : json_geom["buffers"])
+		{
+			ManifestBuffer buf;
+			buf.padding = 0;
+			buf.size = json_buf["size"];
+			buf.offset = json_buf.value("offset", next_offset);
+			next_offset = buf.offset + buf.size;
+
+			const std::string type = json_buf["type"];
+			if(!parse_buffer_type(type, buf.type))
+			{
+				BOOST_LOG_TRIVIAL(warning) << "Buffer " << type << " discarded";
+				continue;
+			}
+			buffers_storage.push_back(buf);
+		}
+		geom.nbuffers = buffers_storage.size() - geom.first_buffer;
+		geometries_storage.push_back(geom);
+	}
+
+	const nlohmann::json json_insts = 
+		json_data.value("instances", nlohmann::json::array());
+	for(const nlohmann::json& json_inst : json_insts)
+	{
+		ManifestInstance inst;
+		inst.prototype = json_inst["prototype"];
+		inst.material = manifest_no_material;
+		if(json_inst.contains("material"))
+		{
+			inst.material = materials_storage.size();
+			materials_storage.push_back(parse_material(json_inst["material"]));
+		}
+
+		const nlohmann::json& json_transform = json_inst["transform"];
+		if(json_transform.size() != 16)
+		{
+			BOOST_LOG_TRIVIAL(fatal) << "Instance transforms are 4x4 matrices";
+			throw std::runtime_error("Invalid instance transform");
+		}
+		for(size_t k = 0; k < 16; ++k) inst.transform[k] = json_transform[k];
+		instances_storage.push_back(inst);
+	}
+
+	geometries = geometries_storage.data();
+	ngeometries = geometries_storage.size();
+	materials = materials_storage.data();
+	nmaterials = materials_storage.size();
+	buffers = buffers_storage.data();
+	nbuffers = buffers_storage.size();
+	instances = instances_storage.data();
+	ninstances = instances_storage.size();
+}
+
+void Manifest::load(const boost::filesystem::path& manifest_path)
+{
+	file.open(manifest_path);
+
+	const ManifestHeader* header = table<ManifestHeader>(file, 0, 1);
+	if
+	(
+		std::memcmp(header->magic, manifest_magic, sizeof(manifest_magic)) ||
+		header->version != manifest_version
+	) {
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"\"" << manifest_path.string() << "\" is not a version " <<
+			manifest_version << " scene manifest";
+		throw std::runtime_error("Unsupported scene manifest");
+	}
+
+	ngeometries = header->ngeometries;
+	nmaterials = header->nmaterials;
+	nbuffers = header->nbuffers;
+	ninstances = header->ninstances;
+	geometries = table<ManifestGeometry>
+		(file, header->geometries_offset, ngeometries);
+	materials = table<ManifestMaterial>
+		(file, header->materials_offset, nmaterials);
+	buffers = table<ManifestBuffer>
+		(file, header->buffers_offset, nbuffers);
+	instances = table<ManifestInstance>
+		(file, header->instances_offset, ninstances);
+	const char* settings_blob = table<char>
+		(file, header->settings_offset, header->settings_size);
+
+	settings = nlohmann::json::parse
+	(
+		settings_blob, settings_blob + header->settings_size
+	);
+	buffers_path = settings.value("buffers", std::string());
+	if(buffers_path.empty())
+	{
+		buffers_path = manifest_path.filename();
+		buffers_path.replace_extension(".bin");
+	}
+
+	// Catch corrupted tables here rather than in the loader threads
+	for(size_t g = 0; g < ngeometries; ++g)
+	{
+		if
+		(
+			geometries[g].material >= nmaterials ||
+			(size_t)geometries[g].first_buffer + geometries[g].nbuffers > nbuffers
+		) {
+			BOOST_LOG_TRIVIAL(fatal) << "Geometry " << g << " out of bounds";
+			throw std::runtime_error("Corrupted scene manifest");
+		}
+	}
+	for(size_t k = 0; k < ninstances; ++k)
+	{
+		if
+		(
+			instances[k].material != manifest_no_material &&
+			instances[k].material >= nmaterials
+		) {
+			BOOST_LOG_TRIVIAL(fatal) << "Instance " << k << " out of bounds";
+			throw std::runtime_error("Corrupted scene manifest");
+		}
+	}
+}
+
+void Manifest::write(const boost::filesystem::path& manifest_path) const
+{
+	nlohmann::json json_settings = settings;
+	json_settings["buffers"] = buffers_path.string();
+	const std::string settings_blob = json_settings.dump();
+
+	ManifestHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, manifest_magic, sizeof(manifest_magic));
+	header.version = manifest_version;
+	header.ngeometries = ngeometries;
+	header.nmaterials = nmaterials;
+	header.nbuffers = nbuffers;
+	header.ninstances = ninstances;
+	header.geometries_offset = align8(sizeof(ManifestHeader));
+	header.materials_offset = align8
+		(header.geometries_offset + ngeometries*sizeof(ManifestGeometry));
+	header.buffers_offset = align8
+		(header.materials_offset + nmaterials*sizeof(ManifestMaterial));
+	header.instances_offset = align8
+		(header.buffers_offset + nbuffers*sizeof(ManifestBuffer));
+	header.settings_offset = align8
+		(header.instances_offset + ninstances*sizeof(ManifestInstance));
+	header.settings_size = settings_blob.size();
+
+	std::ofstream out{manifest_path.string(), std::ios::binary};
+	if(!out)
+	{
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"Could not open \"" << manifest_path.string() << "\"";
+		throw std::runtime_error("Could not write scene manifest");
+	}
+
+	auto write_at = [&out](const uint64_t offset, const void* data, size_t size)
+	{
+		static const char zeros[8] = {};
+		out.write(zeros, offset - (uint64_t)out.tellp());
+		out.write((const char*)data, size);
+	};
+	write_at(0, &header, sizeof(header));
+	write_at
+	(
+		header.geometries_offset, geometries,
+		ngeometries*sizeof(ManifestGeometry)
+	);
+	write_at
+	(
+		header.materials_offset, materials,
+		nmaterials*sizeof(ManifestMaterial)
+	);
+	write_at
+	(
+		header.buffers_offset, buffers,
+		nbuffers*sizeof(ManifestBuffer)
+	);
+	write_at
+	(
+		header.instances_offset, instances,
+		ninstances*sizeof(ManifestInstance)
+	);
+	write_at(header.settings_offset, settings_blob.data(), settings_blob.size());
+
+	if(!out)
+	{
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"Could not write \"" << manifest_path.string() << "\"";
+		throw std::runtime_error("Could not write scene manifest");
+	}
+}
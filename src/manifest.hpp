@@ -0,0 +1,151 @@
+#ifndef _MANIFEST_HPP_
+#define _MANIFEST_HPP_
+
+#include "mappedfile.hpp"
+#include "nlohmann/json.hpp"
+
+#include <boost/log/trivial.hpp>
+#include <boost/filesystem.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+/*
+ * Binary scene manifest: the description of a scene without its buffers.
+ * The file is a header followed by fixed-layout tables of geometries,
+ *  materials, buffers and instances, all in native byte order, and a small
+ *  JSON blob with the render settings, camera and load settings. It is
+ *  mapped as a whole and its tables are read in place.
+ */
+
+static const char		manifest_magic[8] = {'B','N','C','R','M','N','F','\0'};
+static const uint32_t	manifest_version = 3;
+// Geometries placed in the scene directly rather than through instances
+static const uint32_t	manifest_no_prototype = ~0u;
+// Instances using the materials of their prototype
+static const uint32_t	manifest_no_material = ~0u;
+
+enum ManifestBufferType : uint32_t
+{
+	buffer_indices = 0,
+	buffer_vertices,
+	buffer_faces,
+	buffer_creaseindices,
+	buffer_creasevalues
+};
+
+enum ManifestGeometryFlags : uint32_t
+{
+	geometry_triangles	= 1 << 0,
+	geometry_smooth		= 1 << 1,
+	// Triangle meshes whose shading frames are interpolated on every hit
+	//  rather than cached per primitive
+	geometry_interpolated_frames	= 1 << 2
+};
+
+class ManifestHeader
+{
+public:
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	ngeometries;
+	uint32_t	nmaterials;
+	uint32_t	nbuffers;
+	uint32_t	ninstances;
+	uint32_t	padding;
+	// Byte offsets from the start of the manifest
+	uint64_t	geometries_offset;
+	uint64_t	materials_offset;
+	uint64_t	buffers_offset;
+	uint64_t	instances_offset;
+	uint64_t	settings_offset;
+	uint64_t	settings_size;
+};
+
+class ManifestGeometry
+{
+public:
+	uint32_t	flags;
+	uint32_t	material;
+	// Range of the buffer table
+	uint32_t	first_buffer;
+	uint32_t	nbuffers;
+	// Geometries sharing a prototype are built into one sub-scene that is
+	//  only visible through instances
+	uint32_t	prototype;
+	// Edge segments of smooth subdivision surfaces, 0 derives them from
+	//  the camera
+	float		tessellation_rate;
+};
+
+class ManifestMaterial
+{
+public:
+	float		albedo[3];
+	float		emittance[3];
+	float		roughness;
+	float		ior;
+};
+
+class ManifestBuffer
+{
+public:
+	uint32_t	type;
+	uint32_t	padding;
+	// Position in the buffers file, always explicit
+	uint64_t	offset;
+	uint64_t	size;
+};
+
+class ManifestInstance
+{
+public:
+	uint32_t	prototype;
+	// Overrides the materials of the prototype
+	uint32_t	material;
+	// Object to world, column-major 4x4
+	float		transform[16];
+};
+
+class Manifest
+{
+public:
+	// Render settings, camera and load settings, as in the JSON scene file
+	nlohmann::json				settings;
+	// Buffers file, relative to the manifest
+	boost::filesystem::path		buffers_path;
+
+	const ManifestGeometry*		geometries;
+	size_t						ngeometries;
+	const ManifestMaterial*		materials;
+	size_t						nmaterials;
+	const ManifestBuffer*		buffers;
+	size_t						nbuffers;
+	const ManifestInstance*		instances;
+	size_t						ninstances;
+
+	Manifest();
+	Manifest(const Manifest&) = delete;
+	Manifest& operator=(const Manifest&) = delete;
+
+	// Picks the format from the file contents
+	void open(const boost::filesystem::path& path);
+	// Parses a JSON scene file, resolving implicit buffer offsets
+	void load_json(const boost::filesystem::path& json_path);
+	// Maps a binary manifest
+	void load(const boost::filesystem::path& manifest_path);
+	void write(const boost::filesystem::path& manifest_path) const;
+
+	static bool is_manifest(const boost::filesystem::path& path);
+
+private:
+	MappedFile						file;
+	// Tables parsed from JSON, the mapping holds them otherwise
+	std::vector<ManifestGeometry>	geometries_storage;
+	std::vector<ManifestMaterial>	materials_storage;
+	std::vector<ManifestBuffer>		buffers_storage;
+	std::vector<ManifestInstance>	instances_storage;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "mappedfile.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+MappedFile::MappedFile()
+	: mapping(nullptr)
+	, file_size(0)
+	, mapping_size(0)
+{}
+
+MappedFile::~MappedFile()
+{
+	if(mapping) munmap((void*)mapping, mapping_size);
+}
+
+void MappedFile::open(const boost::filesystem::path& path)
+{
+	const int fd = ::open(path.string().c_str(), O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0)
+	{
+		if(fd >= 0) close(fd);
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"Could not open \"" << path.string() << "\"";
+		throw std::runtime_error("Could not open file to map");
+	}
+
+	file_size = st.st_size;
+	const size_t page = sysconf(_SC_PAGESIZE);
+	mapping_size = ((file_size + page - 1) / page) * page;
+
+	if(mapping_size > 0)
+	{
+		void* ptr = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(ptr == MAP_FAILED)
+		{
+			close(fd);
+			BOOST_LOG_TRIVIAL(fatal) <<
+				"Could not map \"" << path.string() << "\"";
+			throw std::runtime_error("Could not map file");
+		}
+		// Buffers are about to be read to build the BVH
+		madvise(ptr, mapping_size, MADV_WILLNEED);
+		mapping = (const char*)ptr;
+	}
+	close(fd);
+}
+
+bool MappedFile::is_open() const
+{
+	return mapping != nullptr;
+}
+
+const char* MappedFile::data() const
+{
+	return mapping;
+}
+
+size_t MappedFile::size() const
+{
+	return file_size;
+}
+
+size_t MappedFile::readable_size() const
+{
+	return mapping_size;
+}
@@ -0,0 +1,32 @@
+#ifndef _MAPPEDFILE_HPP_
+#define _MAPPEDFILE_HPP_
+
+#include <boost/filesystem.hpp>
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	void open(const boost::filesystem::path& path);
+	bool is_open() const;
+
+	const char*	data() const;
+	size_t		size() const;
+	// Bytes that can be read from data(): the mapping spans whole pages
+	//  and what lies past the end of the file reads as zeros.
+	size_t		readable_size() const;
+
+private:
+	const char*	mapping;
+	size_t		file_size;
+	size_t		mapping_size;
+};
+
+#endif
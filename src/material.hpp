@@ -8,6 +8,9 @@ class Material
 public:
 	Vec3f albedo;
 	Vec3f emittance;
+	// GGX alpha of the specular lobe
+	float roughness;
+	float ior;
 };
 
 #endif
\ No newline at end of file
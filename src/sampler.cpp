@@ -0,0 +1,112 @@
+#include "sampler.hpp"
+
+// PCG output permutation, Jarzynski and Olano 2020
+uint32_t hash(const uint32_t x)
+{
+	const uint32_t state = x * 747796405u + 2891336453u;
+	const uint32_t word = 
+		((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+uint32_t hash_combine(const uint32_t seed, const uint32_t v)
+{
+	return seed ^ (hash(v) + (seed << 6) + (seed >> 2));
+}
+
+// 24 bits fill the float mantissa, keeping the result below 1
+float to_unit(const uint32_t x)
+{
+	return (x >> 8) * 0x1p-24f;
+}
+
+uint32_t reverse_bits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Burley, "Practical Hash-based Owen Scrambling", JCGT 2020
+uint32_t laine_karras_permutation(uint32_t x, const uint32_t seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return x;
+}
+
+uint32_t nested_uniform_scramble(const uint32_t x, const uint32_t seed)
+{
+	return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// First two Sobol dimensions: van der Corput and its Pascal matrix twin
+uint32_t sobol_0(const uint32_t i)
+{
+	return reverse_bits(i);
+}
+
+uint32_t sobol_1(uint32_t i)
+{
+	uint32_t r = 0;
+	for(uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+	{
+		if(i & 1) r ^= v;
+	}
+	return r;
+}
+
+Sampler::Sampler()
+	: type(SamplerType::random)
+	, key(0)
+	, index(0)
+{}
+
+Sampler::Sampler
+(
+	const SamplerType	type,
+	const uint32_t		pixel,
+	const uint32_t		sample,
+	const uint32_t		seed
+)
+	: type(type)
+	, key(hash(pixel ^ hash(seed)))
+	, index(sample)
+{
+	// Random numbers are drawn per sample, Sobol points per pixel
+	if(type == SamplerType::random) key = hash(key ^ hash(sample));
+}
+
+Vec2f Sampler::pixel() const
+{
+	return get2d(0);
+}
+
+Vec2f Sampler::bounce(const unsigned depth, const BounceDimension dim) const
+{
+	return get2d(1 + depth*bounce_dims + dim);
+}
+
+Vec2f Sampler::get2d(const uint32_t dim) const
+{
+	const uint32_t seed = hash_combine(key, dim);
+	if(type == SamplerType::random)
+	{
+		return {to_unit(hash(seed)), to_unit(hash(seed ^ 0x9e3779b9u))};
+	}
+
+	// Every pair of dimensions gets its own shuffle of the sequence,
+	//  which decorrelates them as padding would.
+	const uint32_t i = nested_uniform_scramble(index, seed);
+	return
+	{
+		to_unit(nested_uniform_scramble(sobol_0(i), hash_combine(seed, 0))),
+		to_unit(nested_uniform_scramble(sobol_1(i), hash_combine(seed, 1)))
+	};
+}
@@ -0,0 +1,57 @@
+#ifndef _SAMPLER_HPP_
+#define _SAMPLER_HPP_
+
+#include "math.hpp"
+
+#include <cstdint>
+
+enum class SamplerType
+{
+	// Independent uniform numbers
+	random,
+	// Owen scrambled Sobol (0,2)-sequence for every pair of dimensions
+	sobol
+};
+
+// Pairs of dimensions drawn at every bounce
+enum BounceDimension
+{
+	// Position on the sampled light
+	dim_light = 0,
+	// BSDF direction
+	dim_bsdf,
+	// Light selection and Russian roulette
+	dim_misc,
+	bounce_dims
+};
+
+/*
+ * Sample values of a camera sample. They only depend on (pixel, sample
+ *  index, seed) and on the dimension pair asked for, so every sample is
+ *  reproducible whatever thread renders it and in whatever order.
+ * Dimension pair 0 is the position in the pixel, then every bounce gets
+ *  its own bounce_dims pairs.
+ */
+class Sampler
+{
+public:
+	Sampler();
+	Sampler
+	(
+		const SamplerType	type,
+		const uint32_t		pixel,
+		const uint32_t		sample,
+		const uint32_t		seed
+	);
+
+	Vec2f pixel() const;
+	Vec2f bounce(const unsigned depth, const BounceDimension dim) const;
+	Vec2f get2d(const uint32_t dim) const;
+
+private:
+	SamplerType	type;
+	uint32_t	key;
+	uint32_t	index;
+};
+
+#endif
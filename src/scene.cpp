@@ -1,6 +1,6 @@
 #include "scene.hpp"
 
-void load_buffer(
+const void* load_buffer(
 			RTCGeometry		embree_geom,
 			std::ifstream&	buffers_file,
 	const	size_t			element_size,
@@ -14,6 +14,358 @@ void load_buffer(
 		embree_data_format, element_size, buffer_size / element_size
 	);
 	buffers_file.read((char*)embree_buf, buffer_size);
+	if(!buffers_file)
+	{
+		BOOST_LOG_TRIVIAL(fatal) << "Could not read the scene buffers file";
+		throw std::runtime_error("Truncated scene buffers file");
+	}
+	return embree_buf;
+}
+
+/*
+ * Hands a region of the mapped buffers file to Embree without copying.
+ * Embree wants 4 byte aligned offsets and reads vertex buffers with
+ *  16 byte loads, so the last vertex must be followed by 4 readable
+ *  bytes. Regions that do not qualify are copied.
+ */
+const void* map_buffer(
+			RTCGeometry		embree_geom,
+	const	MappedFile&		buffers_map,
+	const	size_t			offset,
+	const	size_t			element_size,
+	const	size_t			buffer_size,
+	const	RTCBufferType	embree_buf_type,
+	const	RTCFormat		embree_data_format,
+			bool&			shared
+) {
+	if(offset + buffer_size > buffers_map.size())
+	{
+		BOOST_LOG_TRIVIAL(fatal) << "Buffer past the end of the buffers file";
+		throw std::runtime_error("Truncated scene buffers file");
+	}
+
+	const size_t padding = embree_buf_type == RTC_BUFFER_TYPE_VERTEX ? 4 : 0;
+	shared = 
+		offset % 4 == 0 &&
+		offset + buffer_size + padding <= buffers_map.readable_size();
+
+	if(shared)
+	{
+		rtcSetSharedGeometryBuffer
+		(
+			embree_geom, embree_buf_type, 0, embree_data_format,
+			buffers_map.data(), offset, 
+			element_size, buffer_size / element_size
+		);
+		return buffers_map.data() + offset;
+	}
+
+	void* embree_buf = rtcSetNewGeometryBuffer
+	(
+		embree_geom, embree_buf_type, 0,
+		embree_data_format, element_size, buffer_size / element_size
+	);
+	std::memcpy(embree_buf, buffers_map.data() + offset, buffer_size);
+	return embree_buf;
+}
+
+// Same derivatives as rtcInterpolate on a triangle: the edges from vertex 0
+void build_frames
+(
+	const GeometryBuffers& buffers,
+	std::vector<TangentFrame>& frames
+) {
+	frames.resize(buffers.nprimitives);
+	for(size_t t = 0; t < buffers.nprimitives; ++t)
+	{
+		const uint32_t* tri = buffers.indices + 3*t;
+		const float* v0 = buffers.vertices + 3*tri[0];
+		const float* v1 = buffers.vertices + 3*tri[1];
+		const float* v2 = buffers.vertices + 3*tri[2];
+		TangentFrame& frame = frames[t];
+		frame.dpdu = Vec3f{v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]};
+		frame.dpdv = Vec3f{v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]};
+		frame.ng = normalize(cross(frame.dpdu, frame.dpdv));
+	}
+}
+
+/*
+ * Edge segments giving the cage edges of a subdivision surface a projected
+ *  length of rs.tessellation_pixels. The mean cage edge is projected at the
+ *  distance of the bounding sphere from the eye, for the closest instance
+ *  in the case of prototypes.
+ */
+float tessellation_rate
+(
+	const Manifest&			manifest,
+	const ManifestGeometry&	geom,
+	const GeometryBuffers&	buffers,
+	const Camera&			camera,
+	const RenderSettings&	rs
+) {
+	if(!buffers.vertices || !buffers.indices || !buffers.faces) return 1;
+
+	Vec3f lower{INFINITY, INFINITY, INFINITY};
+	Vec3f upper{-INFINITY, -INFINITY, -INFINITY};
+	double edge_sum = 0;
+	size_t nedges = 0;
+	size_t idx = 0;
+	for(size_t f = 0; f < buffers.nprimitives; ++f)
+	{
+		const uint32_t n = buffers.faces[f];
+		for(uint32_t k = 0; k < n; ++k)
+		{
+			const float* a = buffers.vertices + 3*buffers.indices[idx + k];
+			const float* b = 
+				buffers.vertices + 3*buffers.indices[idx + (k + 1) % n];
+			const Vec3f pa{a[0], a[1], a[2]};
+			const Vec3f e = Vec3f{b[0], b[1], b[2]} - pa;
+			edge_sum += std::sqrt(dot(e, e));
+			for(int c = 0; c < 3; ++c)
+			{
+				lower[c] = std::min(lower[c], pa[c]);
+				upper[c] = std::max(upper[c], pa[c]);
+			}
+		}
+		nedges += n;
+		idx += n;
+	}
+	if(nedges == 0) return 1;
+
+	const float edge = edge_sum / nedges;
+	const Vec3f center = 0.5f*(lower + upper);
+	const Vec3f half_diagonal = 0.5f*(upper - lower);
+	const float radius = std::sqrt(dot(half_diagonal, half_diagonal));
+	const Vec3f eye = camera.position();
+
+	// Largest edge length over distance among the placements
+	float edge_over_distance = 0;
+	auto place = [&](const Vec3f& c, const float scale)
+	{
+		const Vec3f to_eye = c - eye;
+		const float distance = std::max
+		(
+			std::sqrt(dot(to_eye, to_eye)) - scale*radius, 1e-4f
+		);
+		edge_over_distance = std::max(edge_over_distance, scale*edge / distance);
+	};
+	if(geom.prototype == manifest_no_prototype)
+	{
+		place(center, 1);
+	}
+	else for(size_t k = 0; k < manifest.ninstances; ++k)
+	{
+		const ManifestInstance& inst = manifest.instances[k];
+		if(inst.prototype != geom.prototype) continue;
+		const float* m = inst.transform;
+		const Vec3f x{m[0], m[1], m[2]};
+		const Vec3f y{m[4], m[5], m[6]};
+		const Vec3f z{m[8], m[9], m[10]};
+		const float scale = std::sqrt(std::max
+		(
+			dot(x, x), std::max(dot(y, y), dot(z, z))
+		));
+		const Vec3f p{m[12], m[13], m[14]};
+		place(center[0]*x + center[1]*y + center[2]*z + p, scale);
+	}
+
+	const float pixels = 
+		edge_over_distance / camera.pixel_footprint(rs.height);
+	return std::min
+	(
+		std::max(1.0f, std::ceil(pixels / rs.tessellation_pixels)),
+		rs.max_tessellation_rate
+	);
+}
+
+/*
+ * Loads the buffers of a geometry and commits it. Safe to call from
+ *  several threads at once as long as each has its own buffers_file;
+ *  buffers_file is null when loading from the mapping.
+ */
+RTCGeometry load_geometry(
+	const	Manifest&				manifest,
+	const	size_t					index,
+			RTCDevice				embree_device,
+	const	MappedFile&				buffers_map,
+			std::ifstream*			buffers_file,
+			GeometryBuffers&		buffers,
+			std::vector<TangentFrame>&	frames,
+			std::atomic<size_t>&	shared_bytes,
+			std::atomic<size_t>&	copied_bytes,
+	const	Camera&					camera,
+	const	RenderSettings&			rs
+) {
+	const ManifestGeometry& geom = manifest.geometries[index];
+	const bool triangles = geom.flags & geometry_triangles;
+
+	if(triangles)
+		BOOST_LOG_TRIVIAL(info) << "Loading triangle mesh " << index;
+	else
+		BOOST_LOG_TRIVIAL(info) << "Loading subdiv surface " << index;
+
+	const RTCGeometry embree_geom = rtcNewGeometry
+	(
+		embree_device,
+		triangles ?
+		RTC_GEOMETRY_TYPE_TRIANGLE :
+		RTC_GEOMETRY_TYPE_SUBDIVISION
+	);
+
+	auto load = [&]
+	(
+		const ManifestBuffer&	buf,
+		const size_t			element_size,
+		const RTCBufferType		embree_buf_type,
+		const RTCFormat			embree_data_format
+	) {
+		const size_t size = buf.size;
+		const size_t offset = buf.offset;
+		bool shared = false;
+		const void* data;
+		try
+		{
+			if(buffers_file)
+			{
+				buffers_file->seekg(offset);
+				data = load_buffer
+				(
+					embree_geom, *buffers_file, element_size, size,
+					embree_buf_type, embree_data_format
+				);
+			}
+			else
+			{
+				data = map_buffer
+				(
+					embree_geom, buffers_map, offset, element_size, size,
+					embree_buf_type, embree_data_format, shared
+				);
+			}
+		}
+		catch(...)
+		{
+			// The caller only owns the geometries that loaded
+			rtcReleaseGeometry(embree_geom);
+			throw;
+		}
+		(shared ? shared_bytes : copied_bytes) += size;
+		return data;
+	};
+
+	for(size_t b = 0; b < geom.nbuffers; ++b)
+	{
+		const ManifestBuffer& buf = manifest.buffers[geom.first_buffer + b];
+		bool bufferloaded = false;
+
+		if(buf.type == buffer_indices)
+		{
+			buffers.indices = (const uint32_t*)load
+			(
+				buf,
+				triangles ? 3*sizeof(uint32_t) : sizeof(uint32_t), 
+				RTC_BUFFER_TYPE_INDEX,
+				triangles ? RTC_FORMAT_UINT3 : RTC_FORMAT_UINT
+			);
+			if(triangles)
+			{
+				buffers.nprimitives = buf.size / (3*sizeof(uint32_t));
+			}
+			bufferloaded = true;
+		}
+		else if(buf.type == buffer_vertices)
+		{
+			buffers.vertices = (const float*)load
+			(
+				buf, 3*sizeof(float),
+				RTC_BUFFER_TYPE_VERTEX, RTC_FORMAT_FLOAT3
+			);
+			bufferloaded = true;
+		}
+
+		// If the geometry is a triagle mesh these buffer types are useless
+		// A warning will be thrown if the user tries to load these buffers
+		//  in the context of a triangle mesh.
+		if(!triangles)
+		{
+			if(buf.type == buffer_faces)
+			{
+				buffers.faces = (const uint32_t*)load
+				(
+					buf, sizeof(uint32_t),
+					RTC_BUFFER_TYPE_FACE, RTC_FORMAT_UINT
+				);
+				buffers.nprimitives = buf.size / sizeof(uint32_t);
+				bufferloaded = true;
+			}
+			else if(buf.type == buffer_creaseindices)
+			{
+				load
+				(
+					buf, 2*sizeof(uint32_t),
+					RTC_BUFFER_TYPE_EDGE_CREASE_INDEX, RTC_FORMAT_UINT2
+				);
+				bufferloaded = true;
+			}
+			else if(buf.type == buffer_creasevalues)
+			{
+				load
+				(
+					buf, sizeof(float),
+					RTC_BUFFER_TYPE_EDGE_CREASE_WEIGHT, RTC_FORMAT_FLOAT
+				);
+				bufferloaded = true;
+			}
+		}
+
+		if(!bufferloaded)
+		{
+			BOOST_LOG_TRIVIAL(warning) << 
+				"Buffer type " << buf.type << " of geometry " << index <<
+				" discarded";
+		}
+	}
+
+	// Subdivision levels do not apply on triangle meshes
+	if(!triangles)
+	{
+		const bool is_smooth = geom.flags & geometry_smooth;
+		if(is_smooth)
+		{
+			const float rate = geom.tessellation_rate > 0 ? 
+				geom.tessellation_rate : 
+				tessellation_rate(manifest, geom, buffers, camera, rs);
+			BOOST_LOG_TRIVIAL(info) << 
+				"Tessellation rate of geometry " << index << ": " << rate <<
+				(geom.tessellation_rate > 0 ? " (explicit)" : "");
+			rtcSetGeometryTessellationRate(embree_geom, rate);
+
+			rtcSetGeometrySubdivisionMode
+			(
+				embree_geom, 0,
+				RTC_SUBDIVISION_MODE_PIN_CORNERS
+			);
+		}
+		else
+		{
+			rtcSetGeometryTessellationRate(embree_geom, 0);
+
+			rtcSetGeometrySubdivisionMode
+			(
+				embree_geom, 0,
+				RTC_SUBDIVISION_MODE_PIN_ALL
+			);
+		}
+	}
+
+	if(triangles && !(geom.flags & geometry_interpolated_frames))
+	{
+		build_frames(buffers, frames);
+	}
+
+	rtcSetGeometryBuildQuality(embree_geom, rs.build_quality);
+	rtcCommitGeometry(embree_geom);
+	return embree_geom;
 }
 
 Camera load_camera(const nlohmann::json& json_camera)
@@ -42,61 +394,280 @@ Camera load_camera(const nlohmann::json& json_camera)
 	};
 }
 
-Material load_material(const nlohmann::json& json_material)
+AdaptiveSettings load_adaptive_settings
+(
+	const nlohmann::json& json_adaptive, 
+	const unsigned spp
+) {
+	AdaptiveSettings adaptive = {false, spp, spp, 0, 0};
+	if(!json_adaptive.is_null())
+	{
+		adaptive = {
+			json_adaptive.value("enabled", true),
+			json_adaptive.value("min_spp", std::min(spp, 16u)),
+			json_adaptive.value("max_spp", 4*spp),
+			json_adaptive.value("threshold", 0.02f),
+			json_adaptive.value("noise_target", 0.0f)
+		};
+	}
+
+	// A pass without samples ends the render on a black image
+	if(adaptive.min_spp < 1)
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"min_spp " << adaptive.min_spp << " raised to 1";
+		adaptive.min_spp = 1;
+	}
+	if(adaptive.max_spp < adaptive.min_spp)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "max_spp " << adaptive.max_spp << 
+			" raised to min_spp " << adaptive.min_spp;
+		adaptive.max_spp = adaptive.min_spp;
+	}
+	return adaptive;
+}
+
+DenoiseSettings load_denoise_settings(const nlohmann::json& json_denoise)
 {
-	const nlohmann::json& json_albedo{json_material["albedo"]};
-	const nlohmann::json& json_emittance{json_material["emittance"]}; 
+	if(json_denoise.is_null()) return {false, 5, 1.0f, 0.3f, 0.1f};
 	return {
+		json_denoise.value("enabled", true),
+		json_denoise.value("iterations", 5u),
+		json_denoise.value("sigma_color", 1.0f),
+		json_denoise.value("sigma_normal", 0.3f),
+		json_denoise.value("sigma_albedo", 0.1f)
+	};
+}
+
+SamplerType load_sampler(const std::string& name)
+{
+	if(name == "random") return SamplerType::random;
+	if(name != "sobol")
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Unknown sampler \"" << name << "\", using sobol";
+	}
+	return SamplerType::sobol;
+}
+
+Engine load_engine(const std::string& name)
+{
+	if(name == "wavefront") return Engine::wavefront;
+	if(name != "depthfirst")
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Unknown engine \"" << name << "\", using depthfirst";
+	}
+	return Engine::depthfirst;
+}
+
+RTCBuildQuality load_build_quality(const std::string& name)
+{
+	if(name == "low") return RTC_BUILD_QUALITY_LOW;
+	if(name == "high") return RTC_BUILD_QUALITY_HIGH;
+	if(name != "medium")
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Unknown build quality \"" << name << "\", using medium";
+	}
+	return RTC_BUILD_QUALITY_MEDIUM;
+}
+
+RTCSceneFlags scene_flags(const RenderSettings& rs)
+{
+	return (RTCSceneFlags)
+	(
+		(rs.compact ? RTC_SCENE_FLAG_COMPACT : RTC_SCENE_FLAG_NONE) |
+		(rs.robust ? RTC_SCENE_FLAG_ROBUST : RTC_SCENE_FLAG_NONE)
+	);
+}
+
+// Embree memory monitor adding up the bytes allocated while loading
+bool count_embree_memory(void* counter, const ssize_t bytes, const bool)
+{
+	*(std::atomic<ssize_t>*)counter += bytes;
+	return true;
+}
+
+// Counts what Embree allocates while it lives, the counter must outlive it
+class MemoryMonitor
+{
+public:
+	MemoryMonitor(RTCDevice device, std::atomic<ssize_t>& counter)
+		: device(device)
+	{
+		rtcSetDeviceMemoryMonitorFunction(device, count_embree_memory, &counter);
+	}
+	~MemoryMonitor()
+	{
+		rtcSetDeviceMemoryMonitorFunction(device, nullptr, nullptr);
+	}
+	MemoryMonitor(const MemoryMonitor&) = delete;
+	MemoryMonitor& operator=(const MemoryMonitor&) = delete;
+
+private:
+	RTCDevice	device;
+};
+
+LoadSettings load_load_settings(const nlohmann::json& json_load)
+{
+	if(json_load.is_null()) return {true, 0};
+	return {
+		json_load.value("mmap", true),
+		json_load.value("threads", 0u)
+	};
+}
+
+OutputSettings load_output_settings(const nlohmann::json& json_output)
+{
+	if(json_output.is_null()) return {false, "zip", false};
+	const std::string precision = json_output.value("precision", "float");
+	if(precision != "float" && precision != "half")
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Unknown precision \"" << precision << "\", using float";
+	}
+	return {
+		precision == "half",
+		parse_compression(json_output.value("compression", "zip")),
+		json_output.value("stream", false)
+	};
+}
+
+std::vector<AovType> load_aovs(const nlohmann::json& json_aovs)
+{
+	std::vector<AovType> aovs;
+	for(const std::string name : json_aovs)
+	{
+		AovType type;
+		if(!parse_aov(name, type))
 		{
-			json_albedo[0],
-			json_albedo[1],
-			json_albedo[2]
-		},
-		{
-			json_emittance[0],
-			json_emittance[1],
-			json_emittance[2]
+			BOOST_LOG_TRIVIAL(warning) << "AOV " << name << " discarded";
+			continue;
 		}
-	};
+		if(std::find(aovs.begin(), aovs.end(), type) == aovs.end())
+			aovs.push_back(type);
+	}
+	return aovs;
 }
 
 RenderSettings load_render_settings(const nlohmann::json& json_render_info)
 {
+	const unsigned spp = json_render_info["spp"];
+	const float time_limit = json_render_info.value("time_limit", 0.0f);
 	return {
 		json_render_info["width"],
 		json_render_info["height"],
-		json_render_info["spp"]
+		spp,
+		json_render_info.value("tile_size", 16u),
+		json_render_info.value("pass_spp", 0u),
+		json_render_info.value("seed", 0u),
+		load_sampler(json_render_info.value("sampler", "sobol")),
+		json_render_info.value("max_depth", 4u),
+		json_render_info.value("rr_depth", 3u),
+		json_render_info.value("packets", true),
+		load_engine(json_render_info.value("engine", "depthfirst")),
+		json_render_info.value("wavefront_paths", 1u << 14),
+		load_adaptive_settings
+		(
+			json_render_info.value("adaptive", nlohmann::json()), spp
+		),
+		time_limit,
+		json_render_info.value("time_margin", 0.05f*time_limit),
+		load_build_quality(json_render_info.value("build_quality", "medium")),
+		json_render_info.value("compact", false),
+		json_render_info.value("robust", false),
+		json_render_info.value("tessellation_pixels", 4.0f),
+		json_render_info.value("max_tessellation_rate", 32.0f),
+		Filter
+		(
+			parse_filter(json_render_info.value("filter", "box")),
+			json_render_info.value("filter_radius", 0.0f)
+		),
+		load_output_settings(json_render_info.value("output", nlohmann::json())),
+		load_aovs(json_render_info.value("aovs", nlohmann::json::array())),
+		load_denoise_settings(json_render_info.value("denoise", nlohmann::json()))
 	};
 }
 
+Vec3f Instance::point(const Vec3f& v) const
+{
+	return v[0]*x + v[1]*y + v[2]*z + p;
+}
+
+Vec3f Instance::vector(const Vec3f& v) const
+{
+	return v[0]*x + v[1]*y + v[2]*z;
+}
+
 Scene::~Scene()
 {
 	BOOST_LOG_TRIVIAL(info) << "Releasing scene";
+	release();
+}
+
+void Scene::release()
+{
 	rtcReleaseScene(embree_scene);
+	for(RTCScene prototype : prototypes)
+		if(prototype) rtcReleaseScene(prototype);
+	for(RTCGeometry embree_geom : geometries)
+		if(embree_geom) rtcReleaseGeometry(embree_geom);
+}
+
+RTCGeometry Scene::geometry(const RTCHit& hit) const
+{
+	return geometries[hit.geomID];
+}
+
+const Instance* Scene::instance(const RTCHit& hit) const
+{
+	if(hit.instID[0] == RTC_INVALID_GEOMETRY_ID) return nullptr;
+	return &instances[hit.instID[0] - first_instance];
+}
+
+const Material& Scene::material(const RTCHit& hit) const
+{
+	const Instance* inst = instance(hit);
+	if(inst && inst->material >= 0) return materials[inst->material];
+	return materials[hit.geomID];
+}
+
+const TangentFrame* Scene::frame(const RTCHit& hit) const
+{
+	const std::vector<TangentFrame>& geom_frames = frames[hit.geomID];
+	return geom_frames.empty() ? nullptr : &geom_frames[hit.primID];
 }
 
 Scene::Scene(
-	const boost::filesystem::path& json_path, 
-	RTCDevice& embree_device
+	const boost::filesystem::path& scene_path, 
+	RTCDevice& embree_device,
+	const unsigned nthreads,
+	const nlohmann::json& render_overrides
 ) {
 	BOOST_LOG_TRIVIAL(info) << "Loading scene";
-	embree_scene = rtcNewScene(embree_device);
 
-	nlohmann::json json_data;
-	std::ifstream json_file{json_path.string()};
-	if(!json_file) 
+	std::atomic<ssize_t> embree_bytes{0};
+	// Unregistered on every exit, throws included
+	const MemoryMonitor memory_monitor(embree_device, embree_bytes);
+	const auto load_start = std::chrono::steady_clock::now();
+
+	// JSON scene files and binary manifests describe the same scene
+	Manifest manifest;
+	manifest.open(scene_path);
+	const nlohmann::json& settings = manifest.settings;
+
+	const LoadSettings load_settings = 
+		load_load_settings(settings.value("load", nlohmann::json()));
+
+	const boost::filesystem::path buffers_file_path = 
+		scene_path.parent_path() / manifest.buffers_path;
+	if(load_settings.mmap)
 	{
-		BOOST_LOG_TRIVIAL(fatal) <<
-			"Could not open \"" << json_path.string() << "\"";
-		throw std::runtime_error("Could not open scene file");
+		BOOST_LOG_TRIVIAL(info) << "Mapping buffers file";
+		buffers_map.open(buffers_file_path);
 	}
-	json_file >> json_data;
-	json_file.close();
-
-	boost::filesystem::path buffers_file_path = json_path;
-	buffers_file_path.replace_extension(".bin");
-	std::ifstream buffers_file{buffers_file_path.string()};
-	if(!buffers_file) 
+	else if(!boost::filesystem::exists(buffers_file_path))
 	{
 		BOOST_LOG_TRIVIAL(fatal) <<
 			"Could not open \"" << buffers_file_path.string() << "\"";
@@ -104,145 +675,255 @@ Scene::Scene(
 	}
 
 	BOOST_LOG_TRIVIAL(info) << "Loading render settings";
-	render_settings = load_render_settings(json_data["render"]);
+	nlohmann::json json_render = settings["render"];
+	// Nested blocks such as output are overridden key by key
+	json_render.merge_patch(render_overrides);
+	render_settings = load_render_settings(json_render);
+	const RenderSettings& rs = render_settings;
 
 	BOOST_LOG_TRIVIAL(info) << "Loading camera";
-	camera = load_camera(json_data["camera"]);
+	camera = load_camera(settings["camera"]);
 
-	BOOST_LOG_TRIVIAL(info) << "Loading geometries";
-	for(const nlohmann::json json_geom : json_data["geometries"]) 
+	// Materials are indexed by geomID, the position of the geometry in the
+	//  scene file
+	const size_t ngeometries = manifest.ngeometries;
+	materials.reserve(ngeometries);
+	for(size_t i = 0; i < ngeometries; ++i)
 	{
-		BOOST_LOG_TRIVIAL(info) << "Found geometry";
-
-		const bool triangles = json_geom["triangles"];
-
-		if(triangles)
-			BOOST_LOG_TRIVIAL(info) << "Loading triangle mesh";
-		else
-			BOOST_LOG_TRIVIAL(info) << "Loading subdiv surface";
+		const ManifestMaterial& mat = 
+			manifest.materials[manifest.geometries[i].material];
+		materials.push_back
+		({
+			{mat.albedo[0], mat.albedo[1], mat.albedo[2]},
+			{mat.emittance[0], mat.emittance[1], mat.emittance[2]},
+			mat.roughness,
+			mat.ior
+		});
+	}
 
-		const RTCGeometry embree_geom = rtcNewGeometry
-		(
-			embree_device,
-			triangles ?
-			RTC_GEOMETRY_TYPE_TRIANGLE :
-			RTC_GEOMETRY_TYPE_SUBDIVISION
-		);
+	// The destructor does not run when the constructor throws, the Embree
+	//  objects created from here on are released before every throw
+	embree_scene = rtcNewScene(embree_device);
+	geometries.assign(ngeometries, nullptr);
+	std::vector<GeometryBuffers> geometry_buffers(ngeometries);
+	frames.assign(ngeometries, {});
+	std::atomic<size_t> shared_bytes{0};
+	std::atomic<size_t> copied_bytes{0};
 
-		for(const nlohmann::json json_buf : json_geom["buffers"])
+	std::atomic<size_t> next_geometry{0};
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto keep_error = [&](const std::exception_ptr e)
+	{
+		std::lock_guard<std::mutex> lock(error_mutex);
+		if(!error) error = e;
+		// Let the other threads drain the remaining geometries
+		next_geometry = ngeometries;
+	};
+	auto load_geometries = [&]()
+	{
+		std::ifstream buffers_file;
+		if(!load_settings.mmap)
 		{
-			std::string type = json_buf["type"];
-			bool bufferloaded = false;
-
-			if(type == "indices")
+			buffers_file.open(buffers_file_path.string(), std::ios::binary);
+			if(!buffers_file)
 			{
-				BOOST_LOG_TRIVIAL(info) << "Loading indices";
-				load_buffer
+				BOOST_LOG_TRIVIAL(fatal) <<
+					"Could not open \"" << buffers_file_path.string() << "\"";
+				keep_error(std::make_exception_ptr
 				(
-					embree_geom, buffers_file,
-					triangles ? 3*sizeof(uint32_t) : sizeof(uint32_t), 
-					(size_t)json_buf["size"], 
-					RTC_BUFFER_TYPE_INDEX,
-					triangles ? RTC_FORMAT_UINT3 : RTC_FORMAT_UINT
-				);
-				bufferloaded = true;
+					std::runtime_error("Could not open scene buffers file")
+				));
+				return;
 			}
-			else if(type == "vertices")
+		}
+
+		for
+		(
+			size_t i = next_geometry++;
+			i < ngeometries;
+			i = next_geometry++
+		) {
+			try
 			{
-				BOOST_LOG_TRIVIAL(info) << "Loading vertices";
-				load_buffer
+				geometries[i] = load_geometry
 				(
-					embree_geom, buffers_file,
-					3*sizeof(float), (size_t)json_buf["size"], 
-					RTC_BUFFER_TYPE_VERTEX, RTC_FORMAT_FLOAT3
+					manifest, i, embree_device, buffers_map,
+					load_settings.mmap ? nullptr : &buffers_file,
+					geometry_buffers[i], frames[i], shared_bytes, copied_bytes,
+					camera, rs
 				);
-				bufferloaded = true;
 			}
+			catch(...)
+			{
+				keep_error(std::current_exception());
+			}
+		}
+	};
 
-			// If the geometry is a triagle mesh these buffer types are useless
-			// A warning will be thrown if the user tries to load these buffers
-			//  in the context of a triangle mesh.
-			if(!triangles)
+	unsigned load_threads = load_settings.threads ? 
+		std::min(load_settings.threads, nthreads) : nthreads;
+	load_threads = 
+		std::max(1u, (unsigned)std::min<size_t>(load_threads, ngeometries));
+
+	BOOST_LOG_TRIVIAL(info) << "Loading " << ngeometries << 
+		" geometries on " << load_threads << " threads";
+	std::vector<std::thread> threads;
+	for(unsigned t = 1; t < load_threads; ++t)
+		threads.emplace_back(load_geometries);
+	load_geometries();
+	for(std::thread& thread : threads)
+		thread.join();
+
+	if(error)
+	{
+		release();
+		std::rethrow_exception(error);
+	}
+
+	BOOST_LOG_TRIVIAL(info) << "Attaching geometries";
+	view_dependent = false;
+	for(size_t i = 0; i < ngeometries; ++i)
+	{
+		const unsigned geomID = (unsigned)i;
+		const ManifestGeometry& geom = manifest.geometries[i];
+		if
+		(
+			!(geom.flags & geometry_triangles) &&
+			(geom.flags & geometry_smooth) &&
+			geom.tessellation_rate <= 0
+		) view_dependent = true;
+		const Material& mat = materials[i];
+		const bool emissive = 
+			mat.emittance[0] > 0 || mat.emittance[1] > 0 || mat.emittance[2] > 0;
+
+		if(geom.prototype != manifest_no_prototype)
+		{
+			if(prototypes.size() <= geom.prototype)
+				prototypes.resize(geom.prototype + 1, nullptr);
+			RTCScene& prototype = prototypes[geom.prototype];
+			if(!prototype)
 			{
-				if(type == "faces")
-				{
-					BOOST_LOG_TRIVIAL(info) << "Loading faces";
-					load_buffer
-					(
-						embree_geom, buffers_file,
-						sizeof(uint32_t), (size_t)json_buf["size"], 
-						RTC_BUFFER_TYPE_FACE, RTC_FORMAT_UINT
-					);
-					bufferloaded = true;
-				}
-				else if(type == "creaseindices")
-				{
-					BOOST_LOG_TRIVIAL(info) << "Loading crease indices";
-					load_buffer
-					(
-						embree_geom, buffers_file,
-						2*sizeof(uint32_t), (size_t)json_buf["size"], 
-						RTC_BUFFER_TYPE_EDGE_CREASE_INDEX, RTC_FORMAT_UINT2
-					);
-					bufferloaded = true;
-				}
-				else if(type == "creasevalues")
-				{
-					BOOST_LOG_TRIVIAL(info) << "Loading crease values";
-					load_buffer
-					(
-						embree_geom, buffers_file,
-						sizeof(float), (size_t)json_buf["size"], 
-						RTC_BUFFER_TYPE_EDGE_CREASE_WEIGHT, RTC_FORMAT_FLOAT
-					);
-					bufferloaded = true;
-				}
+				prototype = rtcNewScene(embree_device);
+				rtcSetSceneFlags(prototype, scene_flags(rs));
+				rtcSetSceneBuildQuality(prototype, rs.build_quality);
 			}
+			rtcAttachGeometryByID(prototype, geometries[i], geomID);
 
-			if(!bufferloaded)
+			// The light sampler works in world space on single copies
+			if(emissive)
 			{
-				BOOST_LOG_TRIVIAL(warning) << "Buffer " << type << " discarded";
+				BOOST_LOG_TRIVIAL(warning) << "Emissive prototype geometry " <<
+					i << " is not light sampled";
 			}
+			continue;
 		}
 
-		// Subdivision levels do not apply on triangle meshes
-		if(!triangles)
+		rtcAttachGeometryByID(embree_scene, geometries[i], geomID);
+		if(emissive)
 		{
-			BOOST_LOG_TRIVIAL(info) << "Setting subdivision level";
-			const bool is_smooth = json_geom["smooth"];
-			if(is_smooth)
-			{
-				rtcSetGeometryTessellationRate(embree_geom, 6);
+			BOOST_LOG_TRIVIAL(info) << "Adding geometry " << i << " to the lights";
+			lights.add_geometry
+			(
+				geomID, geometries[i], 
+				geom.flags & geometry_triangles,
+				geometry_buffers[i], mat.emittance
+			);
+		}
+	}
 
-				rtcSetGeometrySubdivisionMode
-				(
-					embree_geom, 0,
-					RTC_SUBDIVISION_MODE_PIN_CORNERS
-				);
-			}
-			else
-			{
-				rtcSetGeometryTessellationRate(embree_geom, 0);
+	const ssize_t loaded_bytes = embree_bytes;
+	const auto build_start = std::chrono::steady_clock::now();
 
-				rtcSetGeometrySubdivisionMode
-				(
-					embree_geom, 0,
-					RTC_SUBDIVISION_MODE_PIN_ALL
-				);
-			}
+	if(!prototypes.empty())
+	{
+		BOOST_LOG_TRIVIAL(info) << 
+			"Committing " << prototypes.size() << " prototypes";
+		for(RTCScene prototype : prototypes)
+			if(prototype) rtcCommitScene(prototype);
+	}
+
+	first_instance = ngeometries;
+	instances.reserve(manifest.ninstances);
+	if(manifest.ninstances > 0)
+	{
+		BOOST_LOG_TRIVIAL(info) << 
+			"Placing " << manifest.ninstances << " instances";
+	}
+	for(size_t k = 0; k < manifest.ninstances; ++k)
+	{
+		const ManifestInstance& inst = manifest.instances[k];
+		if(inst.prototype >= prototypes.size() || !prototypes[inst.prototype])
+		{
+			BOOST_LOG_TRIVIAL(fatal) << 
+				"Instance " << k << " of unknown prototype " << inst.prototype;
+			release();
+			throw std::runtime_error("Unknown prototype");
+		}
+
+		int material = -1;
+		if(inst.material != manifest_no_material)
+		{
+			const ManifestMaterial& mat = manifest.materials[inst.material];
+			material = materials.size();
+			materials.push_back
+			({
+				{mat.albedo[0], mat.albedo[1], mat.albedo[2]},
+				{mat.emittance[0], mat.emittance[1], mat.emittance[2]},
+				mat.roughness,
+				mat.ior
+			});
 		}
 
-		const Material mat = load_material(json_geom["material"]);
-		materials.push_back(mat);
+		const float* m = inst.transform;
+		instances.push_back
+		({
+			{m[0], m[1], m[2]},
+			{m[4], m[5], m[6]},
+			{m[8], m[9], m[10]},
+			{m[12], m[13], m[14]},
+			material
+		});
 
-		BOOST_LOG_TRIVIAL(info) << "Committing geometry";
-		rtcCommitGeometry(embree_geom);
-		BOOST_LOG_TRIVIAL(info) << "Attaching geometry";
-		rtcAttachGeometry(embree_scene, embree_geom);
-		BOOST_LOG_TRIVIAL(info) << "Releasing geometry";
-		rtcReleaseGeometry(embree_geom);
+		const RTCGeometry embree_inst = 
+			rtcNewGeometry(embree_device, RTC_GEOMETRY_TYPE_INSTANCE);
+		rtcSetGeometryInstancedScene(embree_inst, prototypes[inst.prototype]);
+		rtcSetGeometryTransform
+		(
+			embree_inst, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, m
+		);
+		rtcCommitGeometry(embree_inst);
+		rtcAttachGeometryByID(embree_scene, embree_inst, first_instance + k);
+		rtcReleaseGeometry(embree_inst);
 	}
 
+	BOOST_LOG_TRIVIAL(info) << "Buffers: " << 
+		shared_bytes.load() << " bytes shared with Embree, " << 
+		copied_bytes.load() << " bytes copied";
+
+	BOOST_LOG_TRIVIAL(info) << "Building light sampler";
+	lights.build();
+	if(lights.empty())
+		BOOST_LOG_TRIVIAL(warning) << "No emissive geometry to sample";
+
 	BOOST_LOG_TRIVIAL(info) << "Committing scene";
+	rtcSetSceneFlags(embree_scene, scene_flags(rs));
+	rtcSetSceneBuildQuality(embree_scene, rs.build_quality);
 	rtcCommitScene(embree_scene);
+
+	const auto build_end = std::chrono::steady_clock::now();
+
+	const std::chrono::duration<double> load_time = build_start - load_start;
+	const std::chrono::duration<double> build_time = build_end - build_start;
+	BOOST_LOG_TRIVIAL(info) << 
+		"Loaded geometries in " << load_time.count() << "s, " <<
+		loaded_bytes / (1024.0*1024.0) << " MB allocated by Embree";
+	BOOST_LOG_TRIVIAL(info) << 
+		"Built BVH in " << build_time.count() << "s, " <<
+		(embree_bytes - loaded_bytes) / (1024.0*1024.0) << " MB " <<
+		"(quality " << 
+		(rs.build_quality == RTC_BUILD_QUALITY_LOW ? "low" :
+		 rs.build_quality == RTC_BUILD_QUALITY_HIGH ? "high" : "medium") <<
+		(rs.compact ? ", compact" : "") << 
+		(rs.robust ? ", robust" : "") << ")";
 }
\ No newline at end of file
@@ -4,21 +4,138 @@
 #include "math.hpp"
 #include "camera.hpp"
 #include "material.hpp"
+#include "lights.hpp"
+#include "sampler.hpp"
+#include "mappedfile.hpp"
+#include "manifest.hpp"
+#include "framebuffer.hpp"
+#include "tilewriter.hpp"
+#include "denoiser.hpp"
 #include "nlohmann/json.hpp"
 
 #include <boost/log/trivial.hpp>
 #include <boost/filesystem.hpp>
 
 #include <embree3/rtcore.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+class AdaptiveSettings
+{
+public:
+	bool		enabled;
+	// Samples every pixel gets before the error is estimated
+	unsigned	min_spp;
+	unsigned	max_spp;
+	// Pixels whose relative error is below this stop receiving samples
+	float		threshold;
+	// The render ends when the mean relative error goes below this
+	float		noise_target;
+};
+
+enum class Engine
+{
+	// One path at a time, see Bouncer::estimate_li
+	depthfirst,
+	// Bounce by bounce over streams of paths, see wavefront.cpp
+	wavefront
+};
+
 class RenderSettings
 {
 public:
 	unsigned width;
 	unsigned height;
 	unsigned spp;
+	unsigned tile_size;
+	// Samples per pixel of each progressive pass. 0 renders in one pass.
+	unsigned pass_spp;
+	// Decorrelates the random numbers of different renders
+	unsigned seed;
+	SamplerType sampler;
+	// Bounces after the camera hit
+	unsigned max_depth;
+	// Bounce from which Russian roulette may terminate paths
+	unsigned rr_depth;
+	// Trace camera rays in 8-wide packets instead of one by one
+	bool packets;
+	Engine engine;
+	// Paths in flight per thread in the wavefront engine
+	unsigned wavefront_paths;
+
+	AdaptiveSettings adaptive;
+
+	// Wall clock budget of a render in seconds, 0 for none. Passes stop
+	//  when the next one would not fit, spp stays the upper bound.
+	float time_limit;
+	// Left at the end of the budget for the exit and estimation errors, the
+	//  denoiser and the final write are timed
+	float time_margin;
+
+	// BVH build trade-offs: quality against build time, compact trades
+	//  traversal speed for memory, robust avoids cracks between triangles
+	RTCBuildQuality build_quality;
+	bool compact;
+	bool robust;
+
+	// Smooth surfaces are tessellated so that their cage edges span about
+	//  this many pixels where they come closest to the camera
+	float tessellation_pixels;
+	float max_tessellation_rate;
+
+	// Pixel reconstruction
+	Filter filter;
+
+	OutputSettings output;
+	// Channels written next to the beauty
+	std::vector<AovType> aovs;
+
+	// Post process of the beauty, guided by the albedo and normal AOVs
+	DenoiseSettings denoise;
+};
+
+class LoadSettings
+{
+public:
+	// Share the memory mapped buffers file with Embree instead of
+	//  copying it into Embree buffers
+	bool mmap;
+	// Geometries are loaded and committed in parallel, 0 uses the whole
+	//  thread budget
+	unsigned threads;
+};
+
+// Shading frame of a triangle: the derivatives and normal rtcInterpolate
+//  would return anywhere on it, computed once at load time
+class TangentFrame
+{
+public:
+	Vec3f	dpdu;
+	Vec3f	dpdv;
+	Vec3f	ng;
+};
+
+// Placement of a prototype, the object to world transform of an instance
+class Instance
+{
+public:
+	// Columns of the 3x4 transform
+	Vec3f	x;
+	Vec3f	y;
+	Vec3f	z;
+	Vec3f	p;
+	// Index in Scene::materials overriding the prototype's, -1 if none
+	int		material;
+
+	Vec3f point(const Vec3f& v) const;
+	Vec3f vector(const Vec3f& v) const;
 };
 
 class Scene
@@ -26,16 +143,52 @@ class Scene
 public:
 	RTCScene				embree_scene;
 	Camera					camera;
+	// Indexed by geomID, then the instance material overrides
 	std::vector<Material>	materials;
+	Lights					lights;
 	RenderSettings			render_settings;
 
+	// Every geometry by geomID, including those only reachable through
+	//  instances: prototype geometries keep their position in the scene file
+	//  as geomID in their sub-scene
+	std::vector<RTCGeometry>	geometries;
+	// Per primitive frames by geomID, empty for interpolated geometries
+	std::vector<std::vector<TangentFrame>>	frames;
+	// Instances are attached to embree_scene from first_instance on
+	std::vector<Instance>		instances;
+	unsigned					first_instance;
+	// Some subdivision surfaces are tessellated for the load camera
+	bool						view_dependent;
+
 	~Scene();
+	Scene(const Scene&) = delete;
+	Scene& operator=(const Scene&) = delete;
 
 	Scene
 	(
-		const boost::filesystem::path& json_path, 
-		RTCDevice& embree_device
+		const boost::filesystem::path& scene_path, 
+		RTCDevice& embree_device,
+		const unsigned nthreads,
+		// Settings replacing those of the render block
+		const nlohmann::json& render_overrides = nlohmann::json::object()
 	);
+
+	// Geometry of a hit, instanced or not
+	RTCGeometry geometry(const RTCHit& hit) const;
+	// Instance of a hit, null when the hit is not instanced
+	const Instance* instance(const RTCHit& hit) const;
+	const Material& material(const RTCHit& hit) const;
+	// Cached frame of a hit, null when it must be interpolated
+	const TangentFrame* frame(const RTCHit& hit) const;
+
+private:
+	// Sub-scenes shared by the instances, indexed by prototype
+	std::vector<RTCScene>		prototypes;
+	// Backs the shared Embree buffers, released after the scene
+	MappedFile					buffers_map;
+
+	// Releases the Embree scenes and geometries
+	void release();
 };
 
 #endif
\ No newline at end of file
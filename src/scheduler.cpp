@@ -0,0 +1,75 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+
+TileScheduler::TileScheduler
+(
+	const OIIO::ROI&	image_roi,
+	const unsigned		tile_size,
+	const unsigned		nthreads
+)
+	: queues(std::max(nthreads, 1u))
+	, ntiles(0)
+{
+	const int ts = std::max(tile_size, 1u);
+
+	std::vector<OIIO::ROI> tiles;
+	for(int y = image_roi.ybegin; y < image_roi.yend; y += ts)
+	{
+		for(int x = image_roi.xbegin; x < image_roi.xend; x += ts)
+		{
+			// Border tiles are clamped so that no column or row is dropped
+			tiles.emplace_back
+			(
+				x, std::min(x + ts, image_roi.xend),
+				y, std::min(y + ts, image_roi.yend)
+			);
+		}
+	}
+	ntiles = tiles.size();
+
+	// Every thread starts from a contiguous run of tiles to keep
+	//  its working set coherent until it has to steal.
+	for(size_t i = 0; i < ntiles; ++i)
+	{
+		const size_t qi = (i * queues.size()) / ntiles;
+		queues[qi].tiles.push_back(tiles[i]);
+	}
+}
+
+bool TileScheduler::next(const unsigned thread_id, OIIO::ROI& tile)
+{
+	const size_t nqueues = queues.size();
+	const size_t own = thread_id % nqueues;
+
+	if(pop(queues[own], tile)) return true;
+
+	for(size_t i = 1; i < nqueues; ++i)
+	{
+		if(steal(queues[(own + i) % nqueues], tile)) return true;
+	}
+	return false;
+}
+
+size_t TileScheduler::tilecount() const
+{
+	return ntiles;
+}
+
+bool TileScheduler::pop(TileQueue& queue, OIIO::ROI& tile)
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if(queue.tiles.empty()) return false;
+	tile = queue.tiles.back();
+	queue.tiles.pop_back();
+	return true;
+}
+
+bool TileScheduler::steal(TileQueue& queue, OIIO::ROI& tile)
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if(queue.tiles.empty()) return false;
+	tile = queue.tiles.front();
+	queue.tiles.pop_front();
+	return true;
+}
@@ -0,0 +1,45 @@
+#ifndef _SCHEDULER_HPP_
+#define _SCHEDULER_HPP_
+
+#include <OpenImageIO/imagebuf.h>
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/*
+ * Splits the image in square tiles and hands them out to render threads.
+ * Every thread owns a deque: it pops its own tiles from the back and,
+ *  once it runs dry, steals from the front of the other threads' deques.
+ */
+class TileScheduler
+{
+public:
+	TileScheduler
+	(
+		const OIIO::ROI&	image_roi,
+		const unsigned		tile_size,
+		const unsigned		nthreads
+	);
+
+	// Returns false when there is no tile left to render
+	bool next(const unsigned thread_id, OIIO::ROI& tile);
+
+	size_t tilecount() const;
+
+private:
+	class TileQueue
+	{
+	public:
+		std::mutex				mutex;
+		std::deque<OIIO::ROI>	tiles;
+	};
+
+	std::vector<TileQueue>	queues;
+	size_t					ntiles;
+
+	bool pop(TileQueue& queue, OIIO::ROI& tile);
+	bool steal(TileQueue& queue, OIIO::ROI& tile);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool
+(
+	const unsigned nthreads, 
+	const std::vector<unsigned>& cpus
+)
+	: task(nullptr)
+	, generation(0)
+	, running(0)
+	, stopping(false)
+{
+	for(unsigned ti = 0; ti < nthreads; ++ti)
+		workers.emplace_back(&ThreadPool::work, this, ti, cpus);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(std::thread& worker : workers) worker.join();
+}
+
+unsigned ThreadPool::size() const
+{
+	return workers.size();
+}
+
+void ThreadPool::run(const Task& t)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	task = &t;
+	running = workers.size();
+	error = nullptr;
+	++generation;
+	wake.notify_all();
+	done.wait(lock, [this]{ return running == 0; });
+	task = nullptr;
+
+	if(error) std::rethrow_exception(error);
+}
+
+void ThreadPool::work
+(
+	const unsigned thread_id, 
+	const std::vector<unsigned>& cpus
+) {
+	if(!cpus.empty() && !pin_thread(cpus[thread_id]))
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Could not pin thread " << thread_id << " to CPU " << cpus[thread_id];
+	}
+
+	uint64_t seen = 0;
+	for(;;)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		wake.wait(lock, [&]{ return stopping || generation != seen; });
+		if(stopping) return;
+		seen = generation;
+		const Task& current = *task;
+		lock.unlock();
+
+		std::exception_ptr task_error;
+		try
+		{
+			current(thread_id);
+		}
+		catch(...)
+		{
+			task_error = std::current_exception();
+		}
+
+		lock.lock();
+		if(task_error && !error) error = task_error;
+		if(--running == 0) done.notify_all();
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef _THREADPOOL_HPP_
+#define _THREADPOOL_HPP_
+
+#include "topology.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Render threads started once and reused by every pass and every render.
+ * Workers are pinned when they start, so what they allocate stays on
+ *  their node for the lifetime of the pool.
+ */
+class ThreadPool
+{
+public:
+	using Task = std::function<void(const unsigned thread_id)>;
+
+	// cpus holds the CPU of every worker, empty leaves them unpinned
+	ThreadPool(const unsigned nthreads, const std::vector<unsigned>& cpus);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Runs task once on every worker and waits for all of them. The first
+	//  exception thrown by a worker is rethrown here.
+	void run(const Task& task);
+	unsigned size() const;
+
+private:
+	std::vector<std::thread>	workers;
+	std::mutex					mutex;
+	std::condition_variable		wake;
+	std::condition_variable		done;
+	const Task*					task;
+	// Bumped by every run, workers wait for it to change
+	uint64_t					generation;
+	unsigned					running;
+	bool						stopping;
+	std::exception_ptr			error;
+
+	void work(const unsigned thread_id, const std::vector<unsigned>& cpus);
+};
+
+#endif
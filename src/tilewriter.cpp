@@ -0,0 +1,391 @@
+#include "tilewriter.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+std::string parse_compression(const std::string& name)
+{
+	for
+	(
+		const char* known :
+		{"none", "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa", "dwab"}
+	) {
+		if(name == known) return name;
+	}
+	BOOST_LOG_TRIVIAL(warning) <<
+		"Unknown compression \"" << name << "\", using zip";
+	return "zip";
+}
+
+void set_metadata(OIIO::ImageSpec& spec, const RenderStats& stats)
+{
+	spec.attribute("bouncer:passes", (int)stats.passes);
+	spec.attribute("bouncer:spp", stats.mean_spp);
+	spec.attribute("bouncer:min_spp", (int)stats.min_spp);
+	spec.attribute("bouncer:max_spp", (int)stats.max_spp);
+	spec.attribute("bouncer:denoised", (int)stats.denoised);
+	if(stats.seconds > 0)
+		spec.attribute("bouncer:render_seconds", stats.seconds);
+	if(stats.time_limit > 0)
+		spec.attribute("bouncer:time_limit", stats.time_limit);
+}
+
+bool TileWriter::supports_tiles(const boost::filesystem::path& path)
+{
+	std::unique_ptr<OIIO::ImageOutput> probe =
+		OIIO::ImageOutput::create(path.string());
+	return probe && probe->supports("tiles");
+}
+
+TileWriter::TileWriter
+(
+	const boost::filesystem::path&	p,
+	const unsigned					w,
+	const unsigned					h,
+	const OIIO::ROI&				region,
+	const unsigned					ts,
+	const Framebuffer&				fb,
+	const AovBuffer&				a,
+	const OutputSettings&			settings,
+	const RenderStats&				stats,
+	const unsigned					nthreads
+)
+	: path(p)
+	, output(OIIO::ImageOutput::create(p.string()))
+	, framebuffer(fb)
+	, aovs(a)
+	, nchannels(3 + a.nchannels())
+	, pixel_bytes(0)
+	, width(w)
+	, height(h)
+	, tile_size(std::max(ts, 1u))
+	, tiles_x((w + tile_size - 1) / tile_size)
+	, tiles_y((h + tile_size - 1) / tile_size)
+	, reach(fb.reach())
+	, pending(size_t(tiles_x)*tiles_y, 0)
+	, written(size_t(tiles_x)*tiles_y, false)
+	, nwritten(0)
+	, closing(false)
+{
+	if(!output || !output->supports("tiles"))
+	{
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"\"" << path.string() << "\" is not a tiled image format";
+		throw std::runtime_error("Could not create tiled image");
+	}
+
+	// OpenEXR compresses the tiles of a single write on this many threads
+	OIIO::attribute("exr_threads", (int)nthreads);
+
+	const OIIO::TypeDesc format = 
+		settings.half ? OIIO::TypeDesc::HALF : OIIO::TypeDesc::FLOAT;
+	OIIO::ImageSpec spec(width, height, nchannels, format);
+	spec.channelnames = {"R", "G", "B"};
+	formats.assign(3, format);
+	const std::vector<std::string> aov_names = aovs.channel_names();
+	const std::vector<bool> id = aovs.id_channels();
+	for(size_t c = 0; c < aov_names.size(); ++c)
+	{
+		spec.channelnames.push_back(aov_names[c]);
+		formats.push_back(id[c] ? OIIO::TypeDesc::UINT : format);
+	}
+	spec.channelformats = formats;
+	for(const OIIO::TypeDesc& f : formats) pixel_bytes += f.size();
+	spec.tile_width = tile_size;
+	spec.tile_height = tile_size;
+	spec.attribute("compression", settings.compression);
+	// OpenEXR holds back tiles written out of order in increasing Y files
+	spec.attribute("openexr:lineOrder", "randomY");
+	set_metadata(spec, stats);
+	if(!output->open(path.string(), spec))
+	{
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"Could not open \"" << path.string() << "\": " << output->geterror();
+		throw std::runtime_error("Could not create tiled image");
+	}
+
+	// Same grid as TileScheduler
+	for(int y = region.ybegin; y < region.yend; y += tile_size)
+	for(int x = region.xbegin; x < region.xend; x += tile_size)
+	{
+		const OIIO::ROI tiles = footprint(OIIO::ROI
+		(
+			x, std::min(x + (int)tile_size, region.xend),
+			y, std::min(y + (int)tile_size, region.yend)
+		));
+		for(int ty = tiles.ybegin; ty < tiles.yend; ++ty)
+		for(int tx = tiles.xbegin; tx < tiles.xend; ++tx)
+			++pending[ty*tiles_x + tx];
+	}
+
+	writer = std::thread(&TileWriter::drain, this);
+}
+
+TileWriter::~TileWriter()
+{
+	join();
+	// Only left open when a render failed, the file keeps what was written
+	if(output) output->close();
+}
+
+OIIO::ROI TileWriter::footprint(const OIIO::ROI& tile) const
+{
+	const int x0 = std::max(0, tile.xbegin - (int)reach);
+	const int x1 = std::min((int)width, tile.xend + (int)reach);
+	const int y0 = std::max(0, tile.ybegin - (int)reach);
+	const int y1 = std::min((int)height, tile.yend + (int)reach);
+	if(x0 >= x1 || y0 >= y1) return OIIO::ROI(0, 0, 0, 0);
+	return OIIO::ROI
+	(
+		x0 / tile_size, (x1 - 1) / tile_size + 1,
+		y0 / tile_size, (y1 - 1) / tile_size + 1
+	);
+}
+
+OIIO::ROI TileWriter::pixels(const unsigned tx, const unsigned ty) const
+{
+	return OIIO::ROI
+	(
+		tx*tile_size, std::min((tx + 1)*tile_size, width),
+		ty*tile_size, std::min((ty + 1)*tile_size, height)
+	);
+}
+
+void TileWriter::resolve
+(
+	const OIIO::ROI& roi,
+	float* data,
+	const size_t row_pixels
+) const {
+	const size_t row_stride = row_pixels*nchannels;
+	framebuffer.resolve(roi, data, nchannels, row_stride);
+	if(!aovs.empty()) aovs.resolve(roi, data + 3, nchannels, row_stride);
+}
+
+TileWriter::ReadyTile TileWriter::resolve(const unsigned t) const
+{
+	ReadyTile tile;
+	tile.tx = t % tiles_x;
+	tile.ty = t / tiles_x;
+	// The data beyond the image in border tiles is ignored
+	tile.data.resize(size_t(tile_size)*tile_size*nchannels);
+	resolve(pixels(tile.tx, tile.ty), tile.data.data(), tile_size);
+	return tile;
+}
+
+std::vector<unsigned char> TileWriter::pack
+(
+	const float* data,
+	const size_t npixels
+) const {
+	std::vector<unsigned char> packed(npixels*pixel_bytes);
+	size_t offset = 0;
+	for(unsigned c = 0; c < nchannels; ++c)
+	{
+		// Id channels hold the bits of their uint32 values
+		const OIIO::TypeDesc from = formats[c] == OIIO::TypeDesc::UINT ?
+			OIIO::TypeDesc::UINT : OIIO::TypeDesc::FLOAT;
+		OIIO::convert_image
+		(
+			1, (int)npixels, 1, 1,
+			data + c, from, nchannels*sizeof(float),
+			OIIO::AutoStride, OIIO::AutoStride,
+			packed.data() + offset, formats[c], pixel_bytes,
+			OIIO::AutoStride, OIIO::AutoStride
+		);
+		offset += formats[c].size();
+	}
+	return packed;
+}
+
+void TileWriter::drain()
+{
+	bool failed = false;
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	while(true)
+	{
+		queued.wait(lock, [this]{ return closing || !queue.empty(); });
+		if(queue.empty()) return;
+		std::vector<ReadyTile> tiles;
+		tiles.swap(queue);
+		lock.unlock();
+
+		// Once a write failed the file is broken, the rest is dropped
+		std::exception_ptr e;
+		if(!failed)
+		{
+			try
+			{
+				write(tiles);
+			}
+			catch(...)
+			{
+				e = std::current_exception();
+				failed = true;
+			}
+		}
+
+		lock.lock();
+		if(e) error = e;
+	}
+}
+
+void TileWriter::write(std::vector<ReadyTile>& tiles)
+{
+	std::sort
+	(
+		tiles.begin(), tiles.end(),
+		[](const ReadyTile& a, const ReadyTile& b)
+		{
+			return a.ty != b.ty ? a.ty < b.ty : a.tx < b.tx;
+		}
+	);
+
+	std::vector<float> data;
+	for(size_t i = 0; i < tiles.size();)
+	{
+		size_t j = i + 1;
+		while
+		(
+			j < tiles.size() &&
+			tiles[j].ty == tiles[i].ty &&
+			tiles[j].tx == tiles[j - 1].tx + 1
+		) ++j;
+
+		const OIIO::ROI first = pixels(tiles[i].tx, tiles[i].ty);
+		const OIIO::ROI last = pixels(tiles[j - 1].tx, tiles[i].ty);
+		const size_t run_width = last.xend - first.xbegin;
+		const size_t rows = first.yend - first.ybegin;
+		data.resize(run_width*rows*nchannels);
+		for(size_t k = i; k < j; ++k)
+		{
+			const OIIO::ROI roi = pixels(tiles[k].tx, tiles[k].ty);
+			const size_t row_floats = size_t(roi.xend - roi.xbegin)*nchannels;
+			for(size_t y = 0; y < rows; ++y)
+			{
+				const float* src =
+					tiles[k].data.data() + y*tile_size*nchannels;
+				std::copy
+				(
+					src, src + row_floats,
+					data.data() + (y*run_width + roi.xbegin - first.xbegin)*nchannels
+				);
+			}
+		}
+
+		const std::vector<unsigned char> packed =
+			pack(data.data(), run_width*rows);
+		if
+		(
+			!output->write_tiles
+			(
+				first.xbegin, last.xend, first.ybegin, first.yend, 0, 1,
+				OIIO::TypeDesc::UNKNOWN, packed.data()
+			)
+		) {
+			BOOST_LOG_TRIVIAL(fatal) << "Could not write tiles of \"" <<
+				path.string() << "\": " << output->geterror();
+			throw std::runtime_error("Could not write image tiles");
+		}
+		nwritten += j - i;
+		i = j;
+	}
+}
+
+void TileWriter::join()
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		closing = true;
+	}
+	queued.notify_one();
+	if(writer.joinable()) writer.join();
+}
+
+void TileWriter::tile_done(const OIIO::ROI& tile)
+{
+	std::vector<unsigned> ready;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const OIIO::ROI tiles = footprint(tile);
+		for(int ty = tiles.ybegin; ty < tiles.yend; ++ty)
+		for(int tx = tiles.xbegin; tx < tiles.xend; ++tx)
+		{
+			const size_t t = ty*tiles_x + tx;
+			if(pending[t] > 0 && --pending[t] == 0 && !written[t])
+			{
+				written[t] = true;
+				ready.push_back(t);
+			}
+		}
+	}
+	if(ready.empty()) return;
+
+	// Resolved outside the locks, compressed and written by the writer thread
+	std::vector<ReadyTile> tiles;
+	for(const unsigned t : ready) tiles.push_back(resolve(t));
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		// Stops the render rather than rendering tiles that can not be written
+		if(error) std::rethrow_exception(error);
+		for(ReadyTile& t : tiles) queue.push_back(std::move(t));
+	}
+	queued.notify_one();
+}
+
+void TileWriter::close()
+{
+	join();
+	if(error) std::rethrow_exception(error);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if(nwritten == 0)
+	{
+		// One write for the whole image, compressed in parallel
+		std::vector<float> data(size_t(width)*height*nchannels);
+		resolve(OIIO::ROI(0, width, 0, height), data.data(), width);
+		const std::vector<unsigned char> packed =
+			pack(data.data(), size_t(width)*height);
+		data = std::vector<float>();
+		if
+		(
+			!output->write_tiles
+			(
+				0, width, 0, height, 0, 1, OIIO::TypeDesc::UNKNOWN, packed.data()
+			)
+		) {
+			BOOST_LOG_TRIVIAL(fatal) << "Could not write \"" <<
+				path.string() << "\": " << output->geterror();
+			throw std::runtime_error("Could not write image tiles");
+		}
+	}
+	else
+	{
+		// A row of tiles at a time, the streamed ones left out
+		const size_t streamed = nwritten;
+		for(unsigned ty = 0; ty < tiles_y; ++ty)
+		{
+			std::vector<ReadyTile> tiles;
+			for(unsigned tx = 0; tx < tiles_x; ++tx)
+			{
+				const unsigned t = ty*tiles_x + tx;
+				if(!written[t]) tiles.push_back(resolve(t));
+			}
+			write(tiles);
+		}
+		nwritten = streamed;
+	}
+	BOOST_LOG_TRIVIAL(info) << "Wrote \"" << path.string() << "\" (" <<
+		nwritten << "/" << written.size() << " tiles streamed)";
+
+	const bool closed = output->close();
+	output.reset();
+	if(!closed)
+	{
+		BOOST_LOG_TRIVIAL(fatal) <<
+			"Could not close \"" << path.string() << "\"";
+		throw std::runtime_error("Could not write image");
+	}
+}
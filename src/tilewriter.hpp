@@ -0,0 +1,160 @@
+#ifndef _TILEWRITER_HPP_
+#define _TILEWRITER_HPP_
+
+#include "framebuffer.hpp"
+#include "aov.hpp"
+
+#include <OpenImageIO/imageio.h>
+
+#include <boost/filesystem.hpp>
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class OutputSettings
+{
+public:
+	// 16 bit half float channels rather than 32 bit floats
+	bool		half;
+	// OpenEXR compression: none, rle, zips, zip, piz, pxr24, b44, b44a,
+	//  dwaa or dwab
+	std::string	compression;
+	// Write the image tile by tile during the last pass of a render rather
+	//  than as a whole after every pass
+	bool		stream;
+};
+
+// Falls back to zip on names OpenEXR does not know
+std::string parse_compression(const std::string& name);
+
+// How the image was rendered, recorded in its header
+class RenderStats
+{
+public:
+	unsigned	passes		= 0;
+	// Samples per pixel over the render region
+	unsigned	min_spp		= 0;
+	float		mean_spp	= 0;
+	unsigned	max_spp		= 0;
+	float		seconds		= 0;
+	// 0 when the render had no time budget
+	float		time_limit	= 0;
+	bool		denoised	= false;
+};
+
+void set_metadata(OIIO::ImageSpec& spec, const RenderStats& stats);
+
+/*
+ * Tiled image written from the framebuffer, followed by the AOV channels
+ *  if any. An image tile is final once every render tile whose samples
+ *  may be splatted on it is done. The render thread that completes it
+ *  resolves its pixels and queues it, a writer thread drains the queue.
+ *  Queued tiles that are neighbours on a row go out in a single write,
+ *  which OpenEXR compresses on its own threads, so render threads never
+ *  wait for compression. Tiles still missing are written together when
+ *  the file is closed.
+ */
+class TileWriter
+{
+public:
+	// region and tile_size lay out the render tiles as TileScheduler does,
+	//  the image tiles have the same size but start at the image origin
+	TileWriter
+	(
+		const boost::filesystem::path&	path,
+		const unsigned					width,
+		const unsigned					height,
+		const OIIO::ROI&				region,
+		const unsigned					tile_size,
+		const Framebuffer&				framebuffer,
+		const AovBuffer&				aovs,
+		const OutputSettings&			settings,
+		const RenderStats&				stats,
+		const unsigned					nthreads
+	);
+	~TileWriter();
+	TileWriter(const TileWriter&) = delete;
+	TileWriter& operator=(const TileWriter&) = delete;
+
+	static bool supports_tiles(const boost::filesystem::path& path);
+
+	// A render tile is done and its samples are in the framebuffer
+	void tile_done(const OIIO::ROI& tile);
+	// Writes the tiles not written yet and closes the file
+	void close();
+
+private:
+	// Resolved pixels of an image tile, full size even on the borders
+	class ReadyTile
+	{
+	public:
+		unsigned			tx;
+		unsigned			ty;
+		std::vector<float>	data;
+	};
+
+	boost::filesystem::path				path;
+	std::unique_ptr<OIIO::ImageOutput>	output;
+	const Framebuffer&					framebuffer;
+	const AovBuffer&					aovs;
+	unsigned							nchannels;
+	// Formats of the channels in the file and the size of their pixels
+	std::vector<OIIO::TypeDesc>			formats;
+	size_t								pixel_bytes;
+	unsigned							width;
+	unsigned							height;
+	unsigned							tile_size;
+	unsigned							tiles_x;
+	unsigned							tiles_y;
+	unsigned							reach;
+	// Guards the counts
+	std::mutex							mutex;
+	// Render tiles left before each image tile is final
+	std::vector<unsigned>				pending;
+	std::vector<bool>					written;
+	// Tiles written by the writer thread, the only user of the output
+	//  until close joins it
+	size_t								nwritten;
+
+	std::thread							writer;
+	std::mutex							queue_mutex;
+	std::condition_variable				queued;
+	std::vector<ReadyTile>				queue;
+	bool								closing;
+	// First failure of the writer thread, rethrown to the render threads
+	std::exception_ptr					error;
+
+	// Image tiles under a render tile and the pixels its samples reach
+	OIIO::ROI footprint(const OIIO::ROI& tile) const;
+	// Pixels of an image tile, clipped to the image
+	OIIO::ROI pixels(const unsigned tx, const unsigned ty) const;
+	// All the channels of a region, rows of row_pixels pixels
+	void resolve
+	(
+		const OIIO::ROI& roi,
+		float* data,
+		const size_t row_pixels
+	) const;
+	ReadyTile resolve(const unsigned t) const;
+	// Resolved pixels in the formats of the file channels, written as
+	//  TypeDesc::UNKNOWN. Written as floats, OIIO would take the ids for
+	//  normalized values.
+	std::vector<unsigned char> pack
+	(
+		const float* data,
+		const size_t npixels
+	) const;
+	// Body of the writer thread
+	void drain();
+	// Writes runs of neighbouring tiles of a row with one call each
+	void write(std::vector<ReadyTile>& tiles);
+	// Waits for the writer thread to write what is queued
+	void join();
+};
+
+#endif
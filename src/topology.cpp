@@ -0,0 +1,152 @@
+#include "topology.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <tuple>
+
+PinPolicy parse_pin_policy(const std::string& name)
+{
+	if(name == "compact") return PinPolicy::compact;
+	if(name == "scatter") return PinPolicy::scatter;
+	if(name == "cores") return PinPolicy::cores;
+	if(name != "none")
+	{
+		BOOST_LOG_TRIVIAL(warning) << 
+			"Unknown pinning policy \"" << name << "\", using none";
+	}
+	return PinPolicy::none;
+}
+
+unsigned read_unsigned(const boost::filesystem::path& path)
+{
+	std::ifstream file{path.string()};
+	unsigned value = 0;
+	file >> value;
+	return value;
+}
+
+CpuTopology::CpuTopology()
+	: npackages(0)
+	, nnodes(0)
+	, ncores(0)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) != 0) return;
+
+	const boost::filesystem::path sys_cpus = "/sys/devices/system/cpu";
+	for(unsigned id = 0; id < CPU_SETSIZE; ++id)
+	{
+		if(!CPU_ISSET(id, &set)) continue;
+
+		const boost::filesystem::path dir = sys_cpus / ("cpu" + std::to_string(id));
+		Cpu cpu{id, 0, id, 0, 0};
+		if(boost::filesystem::exists(dir / "topology"))
+		{
+			cpu.package = read_unsigned(dir / "topology/physical_package_id");
+			cpu.core = read_unsigned(dir / "topology/core_id");
+		}
+		// The node of a CPU shows as a nodeN link in its directory
+		boost::system::error_code ec;
+		for(boost::filesystem::directory_iterator it(dir, ec), end; it != end; ++it)
+		{
+			const std::string name = it->path().filename().string();
+			if(name.compare(0, 4, "node") == 0 && name.size() > 4)
+				cpu.node = std::stoul(name.substr(4));
+		}
+		cpus.push_back(cpu);
+	}
+
+	// Siblings share a package and a core id
+	std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b)
+	{
+		return 
+			std::tie(a.node, a.package, a.core, a.id) <
+			std::tie(b.node, b.package, b.core, b.id);
+	});
+	std::set<unsigned> packages, nodes;
+	for(size_t c = 0; c < cpus.size(); ++c)
+	{
+		const bool sibling = c > 0 &&
+			cpus[c].package == cpus[c-1].package &&
+			cpus[c].core == cpus[c-1].core;
+		cpus[c].smt = sibling ? cpus[c-1].smt + 1 : 0;
+		ncores += !sibling;
+		packages.insert(cpus[c].package);
+		nodes.insert(cpus[c].node);
+	}
+	npackages = packages.size();
+	nnodes = nodes.size();
+}
+
+std::vector<unsigned> CpuTopology::placement
+(
+	const PinPolicy policy,
+	const unsigned nthreads
+) const {
+	if(policy == PinPolicy::none || cpus.empty()) return {};
+
+	// cpus is in compact order already
+	std::vector<Cpu> order = cpus;
+	if(policy == PinPolicy::cores)
+	{
+		order.erase
+		(
+			std::remove_if(order.begin(), order.end(), [](const Cpu& cpu)
+			{
+				return cpu.smt > 0;
+			}),
+			order.end()
+		);
+	}
+	else if(policy == PinPolicy::scatter)
+	{
+		// Rank every CPU within its node, siblings after all the cores,
+		//  then interleave the nodes rank by rank
+		std::vector<unsigned> node_rank(cpus.size());
+		std::vector<Cpu> by_smt = cpus;
+		std::stable_sort(by_smt.begin(), by_smt.end(), [](const Cpu& a, const Cpu& b)
+		{
+			return std::tie(a.node, a.smt) < std::tie(b.node, b.smt);
+		});
+		for(size_t c = 0; c < by_smt.size(); ++c)
+		{
+			const bool same_node = c > 0 && by_smt[c].node == by_smt[c-1].node;
+			node_rank[c] = same_node ? node_rank[c-1] + 1 : 0;
+		}
+		std::vector<size_t> indices(by_smt.size());
+		for(size_t c = 0; c < indices.size(); ++c) indices[c] = c;
+		std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b)
+		{
+			return node_rank[a] < node_rank[b];
+		});
+		order.clear();
+		for(const size_t c : indices) order.push_back(by_smt[c]);
+	}
+
+	// More threads than CPUs wrap around
+	std::vector<unsigned> result(nthreads);
+	for(unsigned t = 0; t < nthreads; ++t)
+		result[t] = order[t % order.size()].id;
+	return result;
+}
+
+void CpuTopology::log() const
+{
+	BOOST_LOG_TRIVIAL(info) << "Topology: " << 
+		npackages << " packages, " << nnodes << " NUMA nodes, " <<
+		ncores << " cores, " << cpus.size() << " hardware threads";
+}
+
+bool pin_thread(const unsigned cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
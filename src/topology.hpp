@@ -0,0 +1,60 @@
+#ifndef _TOPOLOGY_HPP_
+#define _TOPOLOGY_HPP_
+
+#include <boost/log/trivial.hpp>
+#include <boost/filesystem.hpp>
+
+#include <string>
+#include <vector>
+
+// Where render threads are pinned
+enum class PinPolicy
+{
+	// Left to the OS scheduler
+	none,
+	// Fill a node, core by core with its SMT siblings, before the next
+	compact,
+	// Round robin over the NUMA nodes, physical cores before siblings
+	scatter,
+	// One thread per physical core, siblings left idle
+	cores
+};
+
+PinPolicy parse_pin_policy(const std::string& name);
+
+class Cpu
+{
+public:
+	unsigned	id;
+	unsigned	package;
+	unsigned	core;
+	unsigned	node;
+	// Rank among the hardware threads of its core
+	unsigned	smt;
+};
+
+// The CPUs of the affinity mask, read from sysfs
+class CpuTopology
+{
+public:
+	std::vector<Cpu>	cpus;
+	unsigned			npackages;
+	unsigned			nnodes;
+	unsigned			ncores;
+
+	CpuTopology();
+
+	// CPU of every render thread, empty for PinPolicy::none
+	std::vector<unsigned> placement
+	(
+		const PinPolicy policy,
+		const unsigned nthreads
+	) const;
+	void log() const;
+};
+
+// Pins the calling thread, its allocations are then first touched on the
+//  node of the CPU
+bool pin_thread(const unsigned cpu);
+
+#endif
@@ -0,0 +1,250 @@
+#include "bouncer.hpp"
+
+void PathQueue::reserve(const size_t capacity, const unsigned max_depth)
+{
+	this->capacity = capacity;
+	vertices = max_depth + 1;
+
+	rays.resize(capacity);
+	throughput.resize(capacity);
+	li.resize(capacity);
+	bsdf_pdf.resize(capacity);
+	pixels.resize(capacity);
+	samplers.resize(capacity);
+	xy.resize(capacity);
+	pixel_uv.resize(capacity);
+	aovs.resize(capacity);
+	bounces.resize(capacity * vertices);
+	nbounces.resize(capacity);
+
+	active.reserve(capacity);
+	rayhits.resize(capacity);
+	order.reserve(capacity);
+	survivors.reserve(capacity);
+	finished.reserve(capacity);
+
+	shadow_rays.resize(capacity);
+	shadow_li.resize(capacity);
+	shadow_path.resize(capacity);
+}
+
+void Bouncer::render_roi_wavefront(
+	const OIIO::ROI roi, 
+	const unsigned pixel_samples,
+	const unsigned thread_id
+) {
+	const RenderSettings& rs = scene.render_settings;
+
+	// Allocated by the thread that uses it, again whenever the settings
+	//  changed since the last render
+	PathQueue& q = path_queues[thread_id];
+	if(q.capacity != rs.wavefront_paths || q.vertices != rs.max_depth + 1)
+		q.reserve(rs.wavefront_paths, rs.max_depth);
+
+	const unsigned width = out_image.size[0];
+	const unsigned max_samples = rs.adaptive.enabled ?
+		rs.adaptive.max_spp : rs.spp;
+
+	size_t count = 0;
+	for(int y = roi.ybegin; y < roi.yend; ++y)
+	for(int x = roi.xbegin; x < roi.xend; ++x)
+	{
+		const unsigned pixel = 
+			(y - out_image.ybegin())*width + (x - out_image.xbegin());
+		PixelAccumulator& px = accumulation[pixel];
+		if(!px.active) continue;
+
+		const unsigned nsamples = 
+			std::min(pixel_samples, max_samples - px.samples);
+
+		const Vec2f xy  {(float)x, (float)y}; 
+		for(unsigned s = 0; s < nsamples; ++s)
+		{
+			const Sampler& sampler = q.samplers[count] = Sampler
+			(
+				rs.sampler, pixel, px.samples + s, rs.seed
+			);
+			q.pixels[count]     = &px;
+			q.xy[count]         = xy;
+			q.pixel_uv[count]   = sampler.pixel();
+			q.rays[count]       = scene.camera.generate_ray
+				(film_space(xy, q.pixel_uv[count], out_image));
+			q.throughput[count] = Vec3f{1, 1, 1};
+			q.li[count]         = Vec3f{};
+			q.bsdf_pdf[count]   = 0;
+			q.nbounces[count]   = 0;
+			q.aovs[count].hit    = false;
+			q.aovs[count].direct = Vec3f{};
+
+			if(++count == q.capacity)
+			{
+				trace_wavefront(q, count, thread_id);
+				count = 0;
+			}
+		}
+	}
+	if(count > 0) trace_wavefront(q, count, thread_id);
+}
+
+void Bouncer::trace_wavefront(
+	PathQueue& q,
+	const size_t count,
+	const unsigned thread_id
+) {
+	const RenderSettings& rs = scene.render_settings;
+	const bool aovs = !aov_buffer.empty();
+
+	RTCIntersectContext intersect_context;
+	rtcInitIntersectContext(&intersect_context);
+	RTCIntersectContext coherent_context;
+	rtcInitIntersectContext(&coherent_context);
+	coherent_context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+	q.active.resize(count);
+	for(size_t k = 0; k < count; ++k) q.active[k] = k;
+
+	for(unsigned depth = 0; !q.active.empty(); ++depth)
+	{
+		// Intersect
+		const size_t n = q.active.size();
+		for(size_t k = 0; k < n; ++k)
+		{
+			q.rayhits[k] = {q.rays[q.active[k]], {}};
+			q.rayhits[k].hit.geomID = RTC_INVALID_GEOMETRY_ID;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		rtcIntersect1M
+		(
+			scene.embree_scene, 
+			depth == 0 ? &coherent_context : &intersect_context,
+			q.rayhits.data(), n, sizeof(RTCRayHit)
+		);
+		if(depth == 0)
+		{
+			const std::chrono::duration<double> elapsed = 
+				std::chrono::steady_clock::now() - start;
+			primary_stats[thread_id]->rays += n;
+			primary_stats[thread_id]->seconds += elapsed.count();
+		}
+
+		// Sort by material, misses go last
+		q.order.resize(n);
+		for(size_t k = 0; k < n; ++k) q.order[k] = k;
+		std::sort(q.order.begin(), q.order.end(),
+			[&q](const unsigned a, const unsigned b)
+			{
+				return q.rayhits[a].hit.geomID < q.rayhits[b].hit.geomID;
+			}
+		);
+
+		// Shade and spawn
+		q.survivors.clear();
+		q.finished.clear();
+		size_t nshadows = 0;
+		for(const unsigned k : q.order)
+		{
+			const unsigned path = q.active[k];
+			const RTCRayHit& rh = q.rayhits[k];
+			const Sampler& sampler = q.samplers[path];
+
+			if(rh.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+			{
+				// Camera rays that miss everything are not valid samples
+				if(depth == 0) q.li[path] = Vec3f{-1, -1, -1};
+				q.finished.push_back(path);
+				continue;
+			}
+
+			const SurfaceHit sh = surface(rh);
+			q.bounces[path*q.vertices + q.nbounces[path]++] = 
+				Vec3f{rh.ray.org_x, rh.ray.org_y, rh.ray.org_z};
+
+			const Material& mat = scene.material(rh.hit);
+			const Vec3f ke = mat.emittance;
+			Vec3f& throughput = q.throughput[path];
+			if(aovs && depth == 0) first_hit(rh, sh, mat, q.aovs[path]);
+
+			if(max_component(ke) > 0)
+			{
+				const float weight = 
+					emission_weight(rh, sh, depth, q.bsdf_pdf[path]);
+				const Vec3f e = weight*(throughput*ke);
+				q.li[path] = q.li[path] + e;
+				if(aovs && depth <= 1) 
+					q.aovs[path].direct = q.aovs[path].direct + e;
+			}
+
+			if(depth == rs.max_depth)
+			{
+				q.finished.push_back(path);
+				continue;
+			}
+
+			const Bsdf bsdf(sh.n, sh.i, mat);
+
+			Vec3f contribution;
+			if
+			(
+				!scene.lights.empty() && 
+				sample_direct
+				(
+					sh, bsdf, depth, sampler, 
+					q.shadow_rays[nshadows], contribution
+				)
+			) {
+				q.shadow_li[nshadows]   = throughput*contribution;
+				q.shadow_path[nshadows] = path;
+				++nshadows;
+			}
+
+			if
+			(
+				continue_path
+				(
+					sh, bsdf, depth, sampler, 
+					throughput, q.bsdf_pdf[path], q.rays[path]
+				)
+			) {
+				q.survivors.push_back(path);
+			}
+			else
+			{
+				q.finished.push_back(path);
+			}
+		}
+
+		// Direct lighting
+		rtcOccluded1M
+		(
+			scene.embree_scene, &intersect_context,
+			q.shadow_rays.data(), nshadows, sizeof(RTCRay)
+		);
+		for(size_t k = 0; k < nshadows; ++k)
+		{
+			if(q.shadow_rays[k].tfar < 0) continue;
+			const unsigned path = q.shadow_path[k];
+			q.li[path] = q.li[path] + q.shadow_li[k];
+			if(aovs && depth == 0) 
+				q.aovs[path].direct = q.aovs[path].direct + q.shadow_li[k];
+		}
+
+		for(const unsigned path : q.finished)
+		{
+			for(unsigned b = 0; b < q.nbounces[path]; ++b)
+			{
+				gatherer.addbounce
+				(
+					thread_id, fromVec3f(q.bounces[path*q.vertices + b])
+				);
+			}
+			finalize_sample
+			(
+				*q.pixels[path], q.li[path], q.xy[path], q.pixel_uv[path],
+				aovs ? &q.aovs[path] : nullptr, thread_id
+			);
+		}
+
+		q.active.swap(q.survivors);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef _WAVEFRONT_HPP_
+#define _WAVEFRONT_HPP_
+
+#include "math.hpp"
+#include "aov.hpp"
+
+#include <embree3/rtcore.h>
+#include <vector>
+
+class PixelAccumulator;
+class Sampler;
+
+/*
+ * Path states of the wavefront engine, in structure of arrays layout.
+ * Per path arrays are indexed by slot, the active list holds the slots
+ *  that are still traced and is rebuilt at every bounce.
+ */
+class PathQueue
+{
+public:
+	size_t		capacity = 0;
+	// Bounce slots of every path
+	unsigned	vertices = 0;
+
+	void reserve(const size_t capacity, const unsigned max_depth);
+
+	// Per path
+	std::vector<RTCRay>				rays;
+	std::vector<Vec3f>				throughput;
+	std::vector<Vec3f>				li;
+	std::vector<float>				bsdf_pdf;
+	std::vector<PixelAccumulator*>	pixels;
+	std::vector<Sampler>			samplers;
+	std::vector<Vec2f>				xy;
+	std::vector<Vec2f>				pixel_uv;
+	// Only filled when AOVs are rendered
+	std::vector<AovSample>			aovs;
+	// Ray origins of every bounce, replayed to the gatherer at the end
+	std::vector<Vec3f>				bounces;
+	std::vector<unsigned>			nbounces;
+
+	// Per active path of the current bounce
+	std::vector<unsigned>			active;
+	std::vector<RTCRayHit>			rayhits;
+	std::vector<unsigned>			order;
+	std::vector<unsigned>			survivors;
+	std::vector<unsigned>			finished;
+
+	// Shadow rays of the current bounce
+	std::vector<RTCRay>				shadow_rays;
+	std::vector<Vec3f>				shadow_li;
+	std::vector<unsigned>			shadow_path;
+};
+
+#endif